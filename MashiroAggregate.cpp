@@ -0,0 +1,207 @@
+//
+//  MashiroAggregate.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroAggregate.h"
+#include "MashiroBatch.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static const char aggregateMagic[8] = { 'M', 'S', 'H', 'R', 'A', 'G', 'G', 'R' };
+static const uint32_t aggregateVersion = 2;
+
+constexpr int MashiroAggregate::bits;
+constexpr size_t MashiroAggregate::bins;
+
+MashiroAggregate::MashiroAggregate() noexcept : table(new Bin[bins]()), imageCount(0), items(0), manifest(0) {
+}
+
+uint32_t MashiroAggregate::binOf(double r, double g, double b) noexcept {
+    auto quantize = [](double value) {
+        return static_cast<uint32_t>(min(max(value, 0.0), 255.0)) >> (8 - bits);
+    };
+    return quantize(r) << (bits * 2) | quantize(g) << bits | quantize(b);
+}
+
+void MashiroAggregate::accumulate(uint32_t bin, uint64_t count, const uint64_t sums[3]) noexcept {
+    Bin& target = this->table[bin];
+    target.count.fetch_add(count, memory_order_relaxed);
+    for (int c = 0; c < 3; c++) target.sums[c].fetch_add(sums[c], memory_order_relaxed);
+}
+
+void MashiroAggregate::add(const vector<MashiroColorWithCount>& pixels) noexcept {
+    // 直方图按颜色排序, 相邻的颜色常落在同一格子中, 先在本地合并再做原子加法
+    uint32_t current = UINT32_MAX;
+    uint64_t count = 0;
+    uint64_t sums[3] = { 0, 0, 0 };
+    for (const auto& colorWithCount : pixels) {
+        const MashiroColor& color = colorWithCount.first;
+        uint32_t bin = binOf(color[0], color[1], color[2]);
+        if (bin != current) {
+            if (count > 0) this->accumulate(current, count, sums);
+            current = bin;
+            count = 0;
+            sums[0] = sums[1] = sums[2] = 0;
+        }
+        count += colorWithCount.second;
+        for (int c = 0; c < 3; c++) sums[c] += static_cast<uint64_t>(color[c] * colorWithCount.second + 0.5);
+    }
+    if (count > 0) this->accumulate(current, count, sums);
+    this->imageCount.fetch_add(1, memory_order_relaxed);
+}
+
+void MashiroAggregate::add(const Cluster& colors, const vector<uint32_t>& weights) noexcept {
+    for (size_t i = 0; i < colors.size() && i < weights.size(); i++) {
+        if (weights[i] == 0) continue;
+        const MashiroColor& color = colors[i];
+        uint64_t sums[3];
+        for (int c = 0; c < 3; c++) sums[c] = static_cast<uint64_t>(min(max(color[c], 0.0), 255.0) * weights[i] + 0.5);
+        this->accumulate(binOf(color[0], color[1], color[2]), weights[i], sums);
+    }
+    this->imageCount.fetch_add(1, memory_order_relaxed);
+}
+
+void MashiroAggregate::track(const vector<string>& paths) noexcept {
+    this->items = paths.size();
+    this->manifest = MashiroBatch::fingerprint(paths);
+    this->done.reset(new atomic<uint64_t>[(this->items + 63) / 64]());
+}
+
+void MashiroAggregate::finish(size_t index) noexcept {
+    if (index < this->items) this->done[index / 64].fetch_or(uint64_t(1) << (index % 64), memory_order_relaxed);
+}
+
+bool MashiroAggregate::finished(size_t index) const noexcept {
+    return index < this->items && (this->done[index / 64].load(memory_order_relaxed) >> (index % 64) & 1);
+}
+
+void MashiroAggregate::merge(const MashiroAggregate& other) noexcept {
+    for (uint32_t bin = 0; bin < bins; bin++) {
+        const Bin& source = other.table[bin];
+        uint64_t count = source.count.load(memory_order_relaxed);
+        if (count == 0) continue;
+        uint64_t sums[3];
+        for (int c = 0; c < 3; c++) sums[c] = source.sums[c].load(memory_order_relaxed);
+        this->accumulate(bin, count, sums);
+    }
+    this->imageCount.fetch_add(other.images(), memory_order_relaxed);
+}
+
+void MashiroAggregate::clear() noexcept {
+    for (size_t bin = 0; bin < bins; bin++) {
+        this->table[bin].count.store(0, memory_order_relaxed);
+        for (int c = 0; c < 3; c++) this->table[bin].sums[c].store(0, memory_order_relaxed);
+    }
+    this->imageCount.store(0, memory_order_relaxed);
+}
+
+uint64_t MashiroAggregate::total() const noexcept {
+    uint64_t total = 0;
+    for (size_t bin = 0; bin < bins; bin++) total += this->table[bin].count.load(memory_order_relaxed);
+    return total;
+}
+
+uint64_t MashiroAggregate::colors(vector<MashiroColorWithCount>& pixels) const noexcept {
+    uint64_t largest = 0;
+    for (size_t bin = 0; bin < bins; bin++) largest = max(largest, this->table[bin].count.load(memory_order_relaxed));
+    uint64_t scale = max<uint64_t>(1, (largest + UINT32_MAX - 1) / UINT32_MAX);
+    
+    pixels.clear();
+    for (size_t bin = 0; bin < bins; bin++) {
+        const Bin& source = this->table[bin];
+        uint64_t count = source.count.load(memory_order_relaxed);
+        if (count == 0) continue;
+        double r = double(source.sums[0].load(memory_order_relaxed)) / count;
+        double g = double(source.sums[1].load(memory_order_relaxed)) / count;
+        double b = double(source.sums[2].load(memory_order_relaxed)) / count;
+        pixels.emplace_back(MashiroColor(r, g, b), static_cast<uint32_t>(max<uint64_t>(1, count / scale)));
+    }
+    return scale;
+}
+
+Cluster MashiroAggregate::cluster(uint32_t k, vector<uint64_t> * weights) const noexcept {
+    vector<MashiroColorWithCount> pixels;
+    uint64_t scale = this->colors(pixels);
+    vector<uint32_t> scaled;
+    Cluster clusters = mashiro::kmeans(pixels, k, 1.0, weights ? &scaled : nullptr);
+    if (weights) {
+        weights->clear();
+        for (uint32_t weight : scaled) weights->emplace_back(uint64_t(weight) * scale);
+    }
+    return clusters;
+}
+
+bool MashiroAggregate::save(const string& path) const noexcept {
+    vector<MashiroAggregateRecord> records;
+    for (uint32_t bin = 0; bin < bins; bin++) {
+        const Bin& source = this->table[bin];
+        MashiroAggregateRecord record;
+        record.count = source.count.load(memory_order_relaxed);
+        if (record.count == 0) continue;
+        record.bin = bin;
+        record.reserved = 0;
+        for (int c = 0; c < 3; c++) record.sums[c] = source.sums[c].load(memory_order_relaxed);
+        records.emplace_back(record);
+    }
+    
+    MashiroAggregateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, aggregateMagic, sizeof(aggregateMagic));
+    header.version = aggregateVersion;
+    header.bits = bits;
+    header.images = this->images();
+    header.count = records.size();
+    header.items = this->items;
+    header.manifest = this->manifest;
+    vector<uint64_t> words((this->items + 63) / 64);
+    for (size_t i = 0; i < words.size(); i++) words[i] = this->done[i].load(memory_order_relaxed);
+    
+    string temporary = path + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(MashiroAggregateRecord));
+        file.write(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uint64_t));
+        file.flush();
+        if (!file) {
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+    return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+bool MashiroAggregate::load(const string& path) noexcept {
+    ifstream file(path, ios::binary);
+    MashiroAggregateHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (memcmp(header.magic, aggregateMagic, sizeof(aggregateMagic)) != 0 || header.version != aggregateVersion || header.bits != bits || header.count > bins) return false;
+    
+    // 全部读完并检查过之后才累加
+    vector<MashiroAggregateRecord> records(header.count);
+    if (!file.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(MashiroAggregateRecord))) return false;
+    for (const auto& record : records) {
+        if (record.bin >= bins) return false;
+    }
+    
+    // 完成标记只对同一个清单有意义, 没有调用track()时忽略
+    vector<uint64_t> words;
+    if (this->done && header.items > 0) {
+        if (header.items != this->items || header.manifest != this->manifest) return false;
+        words.resize((header.items + 63) / 64);
+        if (!file.read(reinterpret_cast<char *>(words.data()), words.size() * sizeof(uint64_t))) return false;
+    }
+    for (const auto& record : records) {
+        this->accumulate(record.bin, record.count, record.sums);
+    }
+    for (size_t i = 0; i < words.size(); i++) this->done[i].fetch_or(words[i], memory_order_relaxed);
+    this->imageCount.fetch_add(header.images, memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,183 @@
+//
+//  MashiroAggregate.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_AGGREGATE_H
+#define MASHIRO_AGGREGATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 聚合文件头, 之后是count个MashiroAggregateRecord, 再之后是(items + 63) / 64个64位的完成标记
+ */
+struct MashiroAggregateHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t bits;
+    std::uint64_t images;
+    std::uint64_t count;
+    
+    /**
+     *  @brief 清单中的图片数与清单的散列, 没有记录完成标记时都为0
+     */
+    std::uint64_t items;
+    std::uint64_t manifest;
+};
+
+/**
+ *  @brief 聚合文件中的一个非空格子
+ */
+struct MashiroAggregateRecord {
+    std::uint32_t bin;
+    std::uint32_t reserved;
+    std::uint64_t count;
+    std::uint64_t sums[3];
+};
+
+/**
+ *  @brief 整个图库的颜色直方图, 可以由多个线程同时累加
+ *
+ *  @discussion 每个通道取高6位, 共262144个格子, 每个格子原子地累加像素个数与各分量的和,
+ *              不需要加锁, 内存固定为8MB, 与图片的数量无关. 格子的颜色取落入其中的颜色的平均值.
+ *              用track()指定清单后, 还会记录清单中哪些图已经加入, 与直方图一起保存, 中断后可以跳过这些图继续
+ */
+class MashiroAggregate {
+public:
+    static constexpr int bits = 6;
+    static constexpr std::size_t bins = std::size_t(1) << (bits * 3);
+    
+    MashiroAggregate() noexcept;
+    MashiroAggregate(const MashiroAggregate&) = delete;
+    MashiroAggregate& operator=(const MashiroAggregate&) = delete;
+    
+    /**
+     *  @brief 加入一张图的直方图, 如mashiro::pixels()的结果
+     */
+    void add(const std::vector<MashiroColorWithCount>& pixels) noexcept;
+    
+    /**
+     *  @brief 加入一张图的调色板
+     *
+     *  @param colors  主要颜色
+     *  @param weights 每种颜色包含的像素个数
+     */
+    void add(const Cluster& colors, const std::vector<std::uint32_t>& weights) noexcept;
+    
+    /**
+     *  @brief 记录清单中哪些图已经加入, 应在load()之前调用
+     *
+     *  @param paths 清单
+     */
+    void track(const std::vector<std::string>& paths) noexcept;
+    
+    /**
+     *  @brief 标记清单中的第index张图已经加入
+     */
+    void finish(std::size_t index) noexcept;
+    
+    /**
+     *  @brief 清单中的第index张图是否已经加入
+     */
+    bool finished(std::size_t index) const noexcept;
+    
+    /**
+     *  @brief 把另一个聚合累加到这里, 不包括完成标记
+     */
+    void merge(const MashiroAggregate& other) noexcept;
+    
+    /**
+     *  @brief 清空
+     */
+    void clear() noexcept;
+    
+    /**
+     *  @brief 已经加入了多少张图
+     */
+    std::uint64_t images() const noexcept {
+        return this->imageCount.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     *  @brief 像素总数
+     */
+    std::uint64_t total() const noexcept;
+    
+    /**
+     *  @brief 输出所有非空的格子
+     *
+     *  @discussion 像素个数超过32位时, 所有格子按同一比例缩小, 非空格子至少为1
+     *
+     *  @param pixels 输出, 原有内容会被替换
+     *
+     *  @return 缩小的比例
+     */
+    std::uint64_t colors(std::vector<MashiroColorWithCount>& pixels) const noexcept;
+    
+    /**
+     *  @brief 整个图库的主要颜色
+     *
+     *  @param k       聚类种数
+     *  @param weights 可选, 输出每一类包含的像素个数
+     */
+    Cluster cluster(std::uint32_t k, std::vector<std::uint64_t> * weights = nullptr) const noexcept;
+    
+    /**
+     *  @brief 保存到文件
+     *
+     *  @discussion 先写临时文件再改名, 中途失败不会破坏上一次保存的结果.
+     *              可以在其他线程累加的同时保存, 得到的是某一时刻附近的快照.
+     *              需要中断后继续时, 一张图的add()与finish()应与save()互斥,
+     *              否则快照中可能有直方图已加入但未标记完成的图
+     *
+     *  @return 是否成功
+     */
+    bool save(const std::string& path) const noexcept;
+    
+    /**
+     *  @brief 读取save()保存的文件, 累加到这里
+     *
+     *  @discussion 调用过track()时, 文件中的完成标记必须属于同一个清单, 否则失败
+     *
+     *  @return 是否成功, 失败时不做任何修改
+     */
+    bool load(const std::string& path) noexcept;
+private:
+    /**
+     *  @brief 一个格子, 所有成员都只做原子加法
+     */
+    struct Bin {
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> sums[3];
+    };
+    
+    std::unique_ptr<Bin[]> table;
+    std::atomic<std::uint64_t> imageCount;
+    
+    /**
+     *  @brief 清单的完成标记, 每张图一位
+     */
+    std::unique_ptr<std::atomic<std::uint64_t>[]> done;
+    std::uint64_t items;
+    std::uint64_t manifest;
+    
+    /**
+     *  @brief 颜色所在的格子
+     */
+    static std::uint32_t binOf(double r, double g, double b) noexcept;
+    
+    /**
+     *  @brief 向一个格子加入count个像素, 分量和为sums
+     */
+    void accumulate(std::uint32_t bin, std::uint64_t count, const std::uint64_t sums[3]) noexcept;
+};
+
+#endif /* MASHIRO_AGGREGATE_H */
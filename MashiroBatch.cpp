@@ -0,0 +1,116 @@
+//
+//  MashiroBatch.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroBatch.h"
+#include "MashiroContext.h"
+#include "MashiroNuma.h"
+#include "MashiroPerf.h"
+#include "MashiroTrace.h"
+#include <fstream>
+#include <memory>
+#include <pthread.h>
+#include <sstream>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+MashiroBatch::MashiroBatch(uint32_t _number, uint32_t _threads, int _convertColor, bool _numa) noexcept : number(_number), threads(_threads), convertColor(_convertColor), numa(_numa) {
+    if (this->threads == 0) this->threads = max(1u, thread::hardware_concurrency());
+}
+
+void MashiroBatch::run(const vector<string>& paths, MashiroBatchCallback callback) noexcept {
+    // 每个工作线程一个计算上下文, 处理过几张图之后不再分配内存.
+    // 上下文在工作线程处理第一张图时才创建, 绑定CPU之后它的缓冲区按首次访问分配在本地节点
+    vector<unique_ptr<MashiroContext>> contexts(this->threads);
+    vector<int> cpus;
+    cpu_set_t affinity;
+    bool restore = false;
+    if (this->numa) {
+        cpus = MashiroNuma::assign(this->threads);
+        // 0号工作线程就是调用者的线程, 结束后恢复它原来的绑定
+        restore = pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) == 0;
+    }
+    
+    const Cluster empty;
+    const vector<uint32_t> none;
+    mashiro::parallel(paths.size(), this->threads, [&](size_t index, uint32_t worker) {
+        if (!contexts[worker]) {
+            if (this->numa) MashiroNuma::pin(cpus[worker]);
+            contexts[worker].reset(new MashiroContext());
+        }
+        
+        // 打开统计时, 回调中可以用MashiroPerf::collect()取出这张图的计数
+        if (MashiroPerf::enabled()) MashiroPerf::reset();
+        MashiroTraceScope span("image", static_cast<int64_t>(index));
+        Mat image;
+        {
+            MashiroPerfScope scope(MashiroPerfDecode);
+            MashiroTraceScope span("decode");
+            image = imread(paths[index]);
+        }
+        if (image.empty()) {
+            callback(index, paths[index], empty, none);
+            return;
+        }
+        MashiroContext& context = *contexts[worker];
+        const Cluster& colors = context.color(image, this->number, this->convertColor);
+        MashiroTraceScope output("callback");
+        callback(index, paths[index], colors, context.weights());
+    });
+    
+    if (restore) pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+}
+
+vector<string> MashiroBatch::manifest(const string& path) noexcept {
+    vector<string> paths;
+    ifstream input(path);
+    string line;
+    while (getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) paths.emplace_back(line);
+    }
+    return paths;
+}
+
+uint64_t MashiroBatch::fingerprint(const vector<string>& paths) noexcept {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const auto& path : paths) {
+        for (unsigned char c : path) hash = (hash ^ c) * 0x100000001b3ull;
+        hash = (hash ^ '\n') * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+string MashiroBatch::format(const string& path, const Cluster& colors, const vector<uint32_t>& weights) noexcept {
+    ostringstream line;
+    line<<path;
+    for (size_t i = 0; i < colors.size(); i++) {
+        line<<'\t'<<colors[i][0]<<','<<colors[i][1]<<','<<colors[i][2]<<','<<(i < weights.size() ? weights[i] : 0);
+    }
+    return line.str();
+}
+
+bool MashiroBatch::parse(const string& line, string& path, Cluster& colors, vector<uint32_t>& weights) noexcept {
+    colors.clear();
+    weights.clear();
+    
+    size_t start = line.find('\t');
+    path = line.substr(0, start);
+    while (start != string::npos) {
+        size_t end = line.find('\t', start + 1);
+        double r, g, b;
+        unsigned long weight;
+        if (sscanf(line.c_str() + start + 1, "%lf,%lf,%lf,%lu", &r, &g, &b, &weight) != 4) return false;
+        colors.emplace_back(r, g, b);
+        weights.emplace_back(static_cast<uint32_t>(weight));
+        start = end;
+    }
+    return !path.empty();
+}
@@ -0,0 +1,78 @@
+//
+//  MashiroBatch.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_BATCH_H
+#define MASHIRO_BATCH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 一张图处理完成后的回调函数
+ *
+ *  @discussion 会在处理这张图的工作线程中被并发调用, 打开MashiroPerf时
+ *              可以在回调中用MashiroPerf::collect()取出这张图各阶段的计数
+ *
+ *  @param index   图片在列表中的位置
+ *  @param path    图片的路径
+ *  @param colors  它的主要颜色, 图片无法读取时为空
+ *  @param weights 每种主要颜色包含的像素个数
+ */
+using MashiroBatchCallback = std::function<void(std::size_t index, const std::string& path, const Cluster& colors, const std::vector<std::uint32_t>& weights)>;
+
+/**
+ *  @brief 批量计算多张图的主要颜色
+ */
+class MashiroBatch {
+public:
+    /**
+     *  @param number       需要几种主要颜色
+     *  @param threads      线程数, 0表示使用全部核心
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     *  @param numa         是否把工作线程绑定到CPU并均匀分布到各个NUMA节点,
+     *                      每个线程的缓冲区分配在它所在的节点, 一张图从解码到回调都在同一个线程中完成
+     */
+    MashiroBatch(std::uint32_t number, std::uint32_t threads = 0, int convertColor = -1, bool numa = false) noexcept;
+    
+    /**
+     *  @brief 处理列表中的所有图片
+     */
+    void run(const std::vector<std::string>& paths, MashiroBatchCallback callback) noexcept;
+    
+    /**
+     *  @brief 读取图片列表, 每行一个路径, 忽略空行
+     */
+    static std::vector<std::string> manifest(const std::string& path) noexcept;
+    
+    /**
+     *  @brief 清单的FNV-1a散列, 用于确认两次处理的是同一个清单
+     */
+    static std::uint64_t fingerprint(const std::vector<std::string>& paths) noexcept;
+    
+    /**
+     *  @brief 把一张图的结果格式化为一行: 路径, 之后每种颜色为"r,g,b,weight", 以tab分隔
+     */
+    static std::string format(const std::string& path, const Cluster& colors, const std::vector<std::uint32_t>& weights) noexcept;
+    
+    /**
+     *  @brief 解析format()输出的一行
+     *
+     *  @return 是否解析成功
+     */
+    static bool parse(const std::string& line, std::string& path, Cluster& colors, std::vector<std::uint32_t>& weights) noexcept;
+private:
+    std::uint32_t number;
+    std::uint32_t threads;
+    int convertColor;
+    bool numa;
+};
+
+#endif /* MASHIRO_BATCH_H */
@@ -0,0 +1,62 @@
+//
+//  MashiroContext.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroContext.h"
+#include "MashiroPerf.h"
+#include "MashiroTrace.h"
+#include <atomic>
+#include <ctime>
+
+using namespace cv;
+using namespace std;
+
+/**
+ *  @brief 每个上下文使用Philox的一个独立stream
+ */
+static atomic<uint64_t> streams(0);
+
+MashiroContext::MashiroContext() noexcept : downsampler(histogram, 1, 1, 0, INTER_AREA), random(static_cast<uint64_t>(time(NULL)), streams++) {
+}
+
+const Cluster& MashiroContext::color(Mat& image, uint32_t number, int convertColor) noexcept {
+    // 缩小到200宽的同时统计直方图
+    {
+        MashiroPerfScope scope(MashiroPerfPixels);
+        MashiroTraceScope span("pixels");
+        this->histogram.clear();
+        this->downsampler.reset(image.cols, image.rows, 200, INTER_AREA, convertColor);
+        for (int i = 0; i < image.rows; i++) {
+            if (this->downsampler.wants(i)) this->downsampler.feed(i, image.ptr<uint8_t>(i));
+        }
+        this->histogram.colors(this->pixels);
+    }
+    
+    // 颜色种数不超过number时, 每种颜色自成一类
+    this->clusters.clear();
+    this->clusterWeights.clear();
+    if (number == 0) return this->clusters;
+    if (this->pixels.size() <= number) {
+        for (const auto& colorWithCount : this->pixels) {
+            this->clusters.emplace_back(colorWithCount.first);
+            this->clusterWeights.emplace_back(colorWithCount.second);
+        }
+        return this->clusters;
+    }
+    
+    uint32_t randmax = static_cast<uint32_t>(this->pixels.size());
+    for (uint32_t i = 0; i < number; i++) {
+        this->clusters.emplace_back(this->pixels[this->random.uniform(randmax)].first);
+    }
+    mashiro::lloyd(this->pixels, this->clusters, 1.0, this->labels, this->sums);
+    
+    this->clusterWeights.assign(this->clusters.size(), 0);
+    for (size_t index = 0; index < this->pixels.size(); index++) {
+        this->clusterWeights[this->labels[index]] += this->pixels[index].second;
+    }
+    return this->clusters;
+}
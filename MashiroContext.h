@@ -0,0 +1,60 @@
+//
+//  MashiroContext.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_CONTEXT_H
+#define MASHIRO_CONTEXT_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "mashiro.h"
+#include "MashiroHistogram.h"
+#include "Philox.h"
+
+/**
+ *  @brief 可重复使用的计算上下文, 持有一次计算用到的全部缓冲区
+ *
+ *  @discussion 缓冲区只增不减, 大小由处理过的最大的图决定. 处理过几张图之后,
+ *              color()不再分配堆内存. 只能在一个线程中使用, 每个工作线程各建一个
+ */
+class MashiroContext {
+public:
+    MashiroContext() noexcept;
+    MashiroContext(const MashiroContext&) = delete;
+    MashiroContext& operator=(const MashiroContext&) = delete;
+    
+    /**
+     *  @brief 计算图上的主要颜色, 与mashiro::color()的做法相同
+     *
+     *  @param image        BGR图像
+     *  @param number       需要几种主要颜色
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     *
+     *  @return 主要颜色, 在下次调用之前有效
+     */
+    const Cluster& color(cv::Mat& image, std::uint32_t number, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 上次color()得到的每种主要颜色包含的像素个数
+     */
+    const std::vector<std::uint32_t>& weights() const noexcept {
+        return this->clusterWeights;
+    }
+private:
+    MashiroHistogram histogram;
+    MashiroDownsampler downsampler;
+    std::vector<MashiroColorWithCount> pixels;
+    std::vector<std::uint32_t> labels;
+    std::vector<std::array<double, 4>> sums;
+    Cluster clusters;
+    std::vector<std::uint32_t> clusterWeights;
+    Philox random;
+};
+
+#endif /* MASHIRO_CONTEXT_H */
@@ -0,0 +1,373 @@
+//
+//  MashiroDaemon.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroDaemon.h"
+#include "MashiroContext.h"
+#include "MashiroTrace.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+constexpr uint32_t MashiroDaemon::maxColors;
+
+/**
+ *  @brief 等待连接上有数据, 每200ms检查一次是否需要停止
+ *
+ *  @return 有数据可读时返回true, 需要停止时返回false
+ */
+static bool waitReadable(int fd, const atomic<bool>& running) noexcept {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (running) {
+        int ready = poll(&pfd, 1, 200);
+        if (ready > 0) return true;
+        if (ready < 0 && errno != EINTR) return false;
+    }
+    return false;
+}
+
+/**
+ *  @brief 读满size字节, 连接断开时返回false
+ *
+ *  @param running 不为空时, 每次读取前等待数据, 需要停止时返回false
+ */
+static bool readFully(int fd, void * buffer, size_t size, const atomic<bool> * running = nullptr) noexcept {
+    uint8_t * p = static_cast<uint8_t *>(buffer);
+    while (size > 0) {
+        if (running && !waitReadable(fd, *running)) return false;
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ *  @brief 写满size字节, 连接断开时返回false
+ */
+static bool writeFully(int fd, const void * buffer, size_t size) noexcept {
+    const uint8_t * p = static_cast<const uint8_t *>(buffer);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ *  @brief 读取请求头, 以及可能附带的文件描述符
+ *
+ *  @discussion 客户端空闲时不会一直阻塞, 需要停止时返回false
+ */
+static bool readRequest(int fd, MashiroRequest& header, int& memory, const atomic<bool>& running) noexcept {
+    memory = -1;
+    if (!waitReadable(fd, running)) return false;
+    
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&memory, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    
+    // 请求头可能没有一次读完
+    if (static_cast<size_t>(n) < sizeof(header) && !readFully(fd, reinterpret_cast<uint8_t *>(&header) + n, sizeof(header) - n, &running)) {
+        if (memory >= 0) close(memory);
+        return false;
+    }
+    return true;
+}
+
+/**
+ *  @brief 转换后仍是3个通道的颜色空间转换, -1表示不转换
+ *
+ *  @discussion 其他转换会让cvtColor抛出异常或者改变通道数
+ */
+static bool acceptsConversion(int32_t code) noexcept {
+    static const int32_t codes[] = {
+        -1, COLOR_BGR2RGB,
+        COLOR_BGR2XYZ, COLOR_RGB2XYZ, COLOR_BGR2YCrCb, COLOR_RGB2YCrCb,
+        COLOR_BGR2HSV, COLOR_RGB2HSV, COLOR_BGR2HSV_FULL, COLOR_RGB2HSV_FULL,
+        COLOR_BGR2HLS, COLOR_RGB2HLS, COLOR_BGR2HLS_FULL, COLOR_RGB2HLS_FULL,
+        COLOR_BGR2Lab, COLOR_RGB2Lab, COLOR_BGR2Luv, COLOR_RGB2Luv,
+        COLOR_BGR2YUV, COLOR_RGB2YUV,
+    };
+    return find(begin(codes), end(codes), code) != end(codes);
+}
+
+MashiroDaemon::MashiroDaemon(const string& _socketPath, uint32_t _threads, size_t _cacheSize) noexcept : socketPath(_socketPath), threads(_threads), cacheSize(_cacheSize), running(false) {
+    if (this->threads == 0) this->threads = max(1u, thread::hardware_concurrency());
+}
+
+int MashiroDaemon::run() noexcept {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (this->socketPath.size() >= sizeof(address.sun_path)) return -1;
+    strncpy(address.sun_path, this->socketPath.c_str(), sizeof(address.sun_path) - 1);
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return -1;
+    unlink(this->socketPath.c_str());
+    if (::bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        close(listener);
+        return -1;
+    }
+    this->running = true;
+    
+    // 工作线程一直存活, 各自持有一个计算上下文
+    vector<thread> workers;
+    for (uint32_t i = 0; i < this->threads; i++) {
+        workers.emplace_back([this]() {
+            MashiroContext context;
+            while (1) {
+                int client;
+                {
+                    unique_lock<mutex> lock(this->connectionsLock);
+                    this->connectionsReady.wait(lock, [this]() { return !this->running || !this->connections.empty(); });
+                    if (this->connections.empty()) return;
+                    client = this->connections.front();
+                    this->connections.pop_front();
+                }
+                {
+                    MashiroTraceScope span("connection");
+                    this->serve(client, context);
+                }
+                close(client);
+            }
+        });
+    }
+    
+    // 定时醒来检查是否需要停止
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    while (this->running) {
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) continue;
+        {
+            lock_guard<mutex> lock(this->connectionsLock);
+            this->connections.push_back(client);
+        }
+        this->connectionsReady.notify_one();
+    }
+    
+    close(listener);
+    unlink(this->socketPath.c_str());
+    this->connectionsReady.notify_all();
+    for (auto& worker : workers) worker.join();
+    return 0;
+}
+
+void MashiroDaemon::stop() noexcept {
+    this->running = false;
+}
+
+void MashiroDaemon::serve(int client, MashiroContext& context) noexcept {
+    MashiroRequest header;
+    int memory;
+    while (this->running && readRequest(client, header, memory, this->running)) {
+        MashiroResponse response = { MashiroDaemon::magic, 0, 0, 0 };
+        Cluster colors;
+        
+        // 路径跟在请求头之后, 先读出来, 参数有误时连接仍然可以继续使用.
+        // magic或kind不认识, 路径长度不合理, 或者其他请求带有不会被读出的数据时,
+        // 无法找到下一个请求头, 回复之后关闭连接
+        string path;
+        bool known = header.kind == MashiroRequestPath || header.kind == MashiroRequestBuffer;
+        bool pathRequest = header.magic == MashiroDaemon::magic && header.kind == MashiroRequestPath;
+        if (pathRequest && header.length > 0 && header.length <= PATH_MAX) {
+            path.assign(header.length, '\0');
+            if (!readFully(client, &path[0], header.length, &this->running)) {
+                if (memory >= 0) close(memory);
+                break;
+            }
+        }
+        bool closing = header.magic != MashiroDaemon::magic || !known || (pathRequest && path.empty()) || (!pathRequest && header.length != 0);
+        
+        if (closing || header.number == 0 || header.number > MashiroDaemon::maxColors || !acceptsConversion(header.convertColor)) {
+            response.status = 1;
+        } else if (header.kind == MashiroRequestPath) {
+            // 文件未修改时直接使用缓存的结果
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0) {
+                response.status = 2;
+            } else {
+                string key = path + '\0' + to_string(info.st_mtime) + ':' + to_string(info.st_size) + ':' + to_string(header.number) + ':' + to_string(header.convertColor);
+                bool cached = false;
+                {
+                    lock_guard<mutex> lock(this->cacheLock);
+                    auto iter = this->cache.find(key);
+                    if (iter != this->cache.end()) {
+                        colors = iter->second;
+                        cached = true;
+                    }
+                }
+                if (!cached) {
+                    Mat image;
+                    {
+                        MashiroTraceScope span("decode");
+                        image = imread(path);
+                    }
+                    if (image.empty()) {
+                        response.status = 2;
+                    } else {
+                        colors = context.color(image, header.number, header.convertColor);
+                        lock_guard<mutex> lock(this->cacheLock);
+                        if (this->cache.emplace(key, colors).second) this->cacheOrder.push_back(key);
+                        while (this->cacheOrder.size() > this->cacheSize) {
+                            this->cache.erase(this->cacheOrder.front());
+                            this->cacheOrder.pop_front();
+                        }
+                    }
+                }
+            }
+        } else if (header.kind == MashiroRequestBuffer && memory >= 0 && header.width > 0 && header.height > 0 && header.width <= INT_MAX / 3 && header.height <= INT_MAX && header.stride >= header.width * 3ull && header.stride <= SIZE_MAX / header.height) {
+            // 直接映射客户端的共享内存, 不复制像素. 映射之后文件再被截短的话, 读到文件之外会收到SIGBUS,
+            // 所以只接受已经加上F_SEAL_SHRINK的文件, 此时检查过的大小不会再变小
+            size_t size = header.stride * header.height;
+            struct stat info;
+            int seals = fcntl(memory, F_GET_SEALS);
+            if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(memory, &info) != 0 || static_cast<uint64_t>(info.st_size) < size) {
+                response.status = 1;
+            } else {
+                void * pixels = mmap(NULL, size, PROT_READ, MAP_SHARED, memory, 0);
+                if (pixels == MAP_FAILED) {
+                    response.status = 2;
+                } else {
+                    Mat image(header.height, header.width, CV_8UC3, pixels, header.stride);
+                    colors = context.color(image, header.number, header.convertColor);
+                    munmap(pixels, size);
+                }
+            }
+        } else {
+            response.status = 1;
+        }
+        if (memory >= 0) close(memory);
+        
+        response.count = static_cast<uint32_t>(colors.size());
+        vector<double> payload;
+        for (const auto& color : colors) {
+            payload.insert(payload.end(), { color[0], color[1], color[2] });
+        }
+        if (!writeFully(client, &response, sizeof(response)) || !writeFully(client, payload.data(), payload.size() * sizeof(double)) || closing) break;
+    }
+}
+
+MashiroClient::MashiroClient(const string& socketPath) noexcept {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    
+    this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd >= 0 && connect(this->fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+MashiroClient::~MashiroClient() noexcept {
+    if (this->fd >= 0) close(this->fd);
+}
+
+bool MashiroClient::color(const string& path, uint32_t number, Cluster& colors, int convertColor) noexcept {
+    MashiroRequest header = { MashiroDaemon::magic, MashiroRequestPath, number, convertColor, 0, 0, 0, static_cast<uint32_t>(path.size()), 0 };
+    return this->request(header, path, -1, colors);
+}
+
+bool MashiroClient::color(int memory, uint32_t width, uint32_t height, uint64_t stride, uint32_t number, Cluster& colors, int convertColor) noexcept {
+    MashiroRequest header = { MashiroDaemon::magic, MashiroRequestBuffer, number, convertColor, width, height, stride, 0, 0 };
+    return this->request(header, string(), memory, colors);
+}
+
+int MashiroClient::share(Mat& image, uint64_t& stride) noexcept {
+    stride = image.cols * image.elemSize();
+    int memory = memfd_create("mashiro", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memory < 0) return -1;
+    size_t size = stride * image.rows;
+    if (ftruncate(memory, size) != 0 || fcntl(memory, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        close(memory);
+        return -1;
+    }
+    void * pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+    if (pixels == MAP_FAILED) {
+        close(memory);
+        return -1;
+    }
+    for (int i = 0; i < image.rows; i++) {
+        memcpy(static_cast<uint8_t *>(pixels) + stride * i, image.ptr(i), stride);
+    }
+    munmap(pixels, size);
+    return memory;
+}
+
+bool MashiroClient::request(const MashiroRequest& header, const string& path, int memory, Cluster& colors) noexcept {
+    if (this->fd < 0) return false;
+    
+    // 文件描述符随请求头一起发送
+    struct iovec iov = { const_cast<MashiroRequest *>(&header), sizeof(header) };
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    if (memory >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memory, sizeof(int));
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(this->fd, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    if (static_cast<size_t>(n) < sizeof(header) && !writeFully(this->fd, reinterpret_cast<const uint8_t *>(&header) + n, sizeof(header) - n)) return false;
+    if (!path.empty() && !writeFully(this->fd, path.data(), path.size())) return false;
+    
+    MashiroResponse response;
+    if (!readFully(this->fd, &response, sizeof(response)) || response.magic != MashiroDaemon::magic) return false;
+    vector<double> payload(response.count * 3);
+    if (!readFully(this->fd, payload.data(), payload.size() * sizeof(double))) return false;
+    
+    colors.clear();
+    for (uint32_t i = 0; i < response.count; i++) {
+        colors.emplace_back(payload[i * 3], payload[i * 3 + 1], payload[i * 3 + 2]);
+    }
+    return response.status == 0;
+}
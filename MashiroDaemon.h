@@ -0,0 +1,182 @@
+//
+//  MashiroDaemon.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_DAEMON_H
+#define MASHIRO_DAEMON_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include "mashiro.h"
+
+class MashiroContext;
+
+/**
+ *  @brief 请求的类型
+ */
+enum MashiroRequestKind : std::uint32_t {
+    /**
+     *  @brief 请求后跟着图片路径
+     */
+    MashiroRequestPath = 0,
+    
+    /**
+     *  @brief 请求附带一个共享内存的文件描述符, 其中是BGR排列的像素, 文件须加上F_SEAL_SHRINK
+     */
+    MashiroRequestBuffer = 1,
+};
+
+/**
+ *  @brief 请求头, 通过Unix domain socket发送
+ */
+struct MashiroRequest {
+    std::uint32_t magic;
+    std::uint32_t kind;
+    std::uint32_t number;
+    std::int32_t convertColor;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint64_t stride;
+    std::uint32_t length;
+    std::uint32_t reserved;
+};
+
+/**
+ *  @brief 响应头, 之后跟着count个颜色, 每个颜色3个double
+ */
+struct MashiroResponse {
+    std::uint32_t magic;
+    std::uint32_t status;
+    std::uint32_t count;
+    std::uint32_t reserved;
+};
+
+/**
+ *  @brief 常驻进程, 在Unix domain socket上提供主要颜色的计算
+ *
+ *  @discussion 线程池与每个线程的缓冲区一直保留, 同一路径(且文件未修改)的结果会被缓存
+ */
+class MashiroDaemon {
+public:
+    /**
+     *  @brief 协议里的magic
+     */
+    static constexpr std::uint32_t magic = 0x5248534D;
+    
+    /**
+     *  @brief 一次请求最多的颜色数
+     */
+    static constexpr std::uint32_t maxColors = 256;
+    
+    /**
+     *  @param socketPath socket的路径, 已存在的文件会被删除
+     *  @param threads    工作线程数, 0表示使用全部核心
+     *  @param cacheSize  最多缓存多少条结果
+     */
+    MashiroDaemon(const std::string& socketPath, std::uint32_t threads = 0, std::size_t cacheSize = 4096) noexcept;
+    
+    /**
+     *  @brief 开始监听, 直到stop()被调用
+     *
+     *  @return 成功退出返回0, 无法监听时返回-1
+     */
+    int run() noexcept;
+    
+    /**
+     *  @brief 停止监听, 可以在信号处理函数里调用
+     *
+     *  @discussion 空闲的连接最多200ms后发现需要停止, 正在处理的请求会先完成
+     */
+    void stop() noexcept;
+private:
+    std::string socketPath;
+    std::uint32_t threads;
+    std::size_t cacheSize;
+    std::atomic<bool> running;
+    
+    /**
+     *  @brief 等待处理的连接
+     */
+    std::deque<int> connections;
+    std::mutex connectionsLock;
+    std::condition_variable connectionsReady;
+    
+    /**
+     *  @brief 路径请求的结果缓存, 按插入顺序淘汰
+     */
+    std::map<std::string, Cluster> cache;
+    std::deque<std::string> cacheOrder;
+    std::mutex cacheLock;
+    
+    /**
+     *  @brief 处理一个连接上的所有请求
+     *
+     *  @param client  连接
+     *  @param context 这个工作线程的计算上下文
+     */
+    void serve(int client, MashiroContext& context) noexcept;
+};
+
+/**
+ *  @brief MashiroDaemon的客户端, 一个对象对应一个连接
+ */
+class MashiroClient {
+public:
+    /**
+     *  @brief 连接到socketPath
+     */
+    MashiroClient(const std::string& socketPath) noexcept;
+    ~MashiroClient() noexcept;
+    
+    MashiroClient(const MashiroClient&) = delete;
+    MashiroClient& operator=(const MashiroClient&) = delete;
+    
+    /**
+     *  @brief 是否已连接
+     */
+    bool connected() const noexcept { return this->fd >= 0; }
+    
+    /**
+     *  @brief 让常驻进程读取并分析一张图
+     *
+     *  @return 是否成功
+     */
+    bool color(const std::string& path, std::uint32_t number, Cluster& colors, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 分析一块共享内存中的像素, 不会复制像素
+     *
+     *  @param memory 共享内存的文件描述符(例如memfd), BGR排列, 每行stride字节.
+     *                必须已经加上F_SEAL_SHRINK, 否则服务端拒绝, share()创建的文件已经加上
+     *
+     *  @return 是否成功
+     */
+    bool color(int memory, std::uint32_t width, std::uint32_t height, std::uint64_t stride, std::uint32_t number, Cluster& colors, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 把图片的像素复制到一块新的共享内存中, 并加上F_SEAL_SHRINK
+     *
+     *  @param stride 输出每行的字节数
+     *
+     *  @return 共享内存的文件描述符, 失败时返回-1
+     */
+    static int share(cv::Mat& image, std::uint64_t& stride) noexcept;
+private:
+    int fd;
+    
+    /**
+     *  @brief 发送请求并等待结果
+     */
+    bool request(const MashiroRequest& header, const std::string& path, int memory, Cluster& colors) noexcept;
+};
+
+#endif /* MASHIRO_DAEMON_H */
@@ -0,0 +1,164 @@
+//
+//  MashiroHistogram.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroHistogram.h"
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+MashiroHistogram::MashiroHistogram(size_t capacity) noexcept {
+    size_t power = 16;
+    while (power < capacity) power <<= 1;
+    this->reserve(power);
+}
+
+void MashiroHistogram::reserve(size_t capacity) noexcept {
+    this->keys.assign(capacity, 0);
+    this->counts.assign(capacity, 0);
+    this->used.clear();
+    this->used.reserve(capacity / 2 + 1);
+    this->mask = capacity - 1;
+    this->shift = 32;
+    while ((size_t(1) << (32 - this->shift)) < capacity) this->shift--;
+}
+
+void MashiroHistogram::clear() noexcept {
+    for (uint32_t slot : this->used) this->keys[slot] = 0;
+    this->used.clear();
+}
+
+uint64_t MashiroHistogram::total() const noexcept {
+    uint64_t total = 0;
+    for (uint32_t slot : this->used) total += this->counts[slot];
+    return total;
+}
+
+void MashiroHistogram::grow() noexcept {
+    vector<pair<uint32_t, uint32_t>> entries;
+    entries.reserve(this->used.size());
+    for (uint32_t slot : this->used) entries.emplace_back(this->keys[slot], this->counts[slot]);
+    
+    this->reserve(this->keys.size() * 2);
+    for (const auto& entry : entries) {
+        this->add(entry.first >> 16 & 0xFF, entry.first >> 8 & 0xFF, entry.first & 0xFF, entry.second);
+    }
+}
+
+void MashiroHistogram::colors(vector<MashiroColorWithCount>& pixels) noexcept {
+    // 按键排序, 与按MashiroColor排序的结果一致. used的顺序不影响其他操作, 直接原地排序
+    sort(this->used.begin(), this->used.end(), [this](uint32_t a, uint32_t b) { return this->keys[a] < this->keys[b]; });
+    
+    pixels.clear();
+    pixels.reserve(this->used.size());
+    for (uint32_t slot : this->used) {
+        uint32_t key = this->keys[slot];
+        pixels.emplace_back(MashiroColor(key >> 16 & 0xFF, key >> 8 & 0xFF, key & 0xFF), this->counts[slot]);
+    }
+}
+
+MashiroDownsampler::MashiroDownsampler(MashiroHistogram& _histogram, int _cols, int _rows, int width, int interpolation, int _convertColor) noexcept : histogram(_histogram) {
+    this->reset(_cols, _rows, width, interpolation, _convertColor);
+}
+
+void MashiroDownsampler::reset(int _cols, int _rows, int width, int interpolation, int _convertColor) noexcept {
+    this->cols = max(1, _cols);
+    this->rows = max(1, _rows);
+    this->convertColor = _convertColor;
+    this->accumulated = 0;
+    
+    // 不缩小时相当于每个块只有一个像素
+    if (width <= 0 || width >= this->cols) width = this->cols;
+    this->outputCols = width;
+    this->outputRows = max(1, min(this->rows, static_cast<int>(static_cast<int64_t>(this->rows) * this->outputCols / this->cols)));
+    this->nearest = interpolation == INTER_NEAREST;
+    
+    this->columnOf.resize(this->cols);
+    this->columnWidth.assign(this->outputCols, 0);
+    for (int x = 0; x < this->cols; x++) {
+        this->columnOf[x] = static_cast<uint32_t>(static_cast<int64_t>(x) * this->outputCols / this->cols);
+        this->columnWidth[this->columnOf[x]]++;
+    }
+    
+    // 取每个块中间的行与列, 第b块的第一行是满足 y * outputRows / rows >= b 的最小的y
+    if (this->nearest) {
+        auto first = [this](int b) { return static_cast<int>((static_cast<int64_t>(b) * this->rows + this->outputRows - 1) / this->outputRows); };
+        this->sampleRows.resize(this->outputRows);
+        for (int b = 0; b < this->outputRows; b++) this->sampleRows[b] = (first(b) + first(b + 1) - 1) / 2;
+        
+        this->sampleCols.resize(this->outputCols);
+        int x = 0;
+        for (int c = 0; c < this->outputCols; c++) {
+            this->sampleCols[c] = x + this->columnWidth[c] / 2;
+            x += this->columnWidth[c];
+        }
+    }
+    
+    this->sums.assign(this->outputCols * 3, 0);
+    this->output.resize(this->outputCols * 3);
+    if (this->convertColor != -1) this->converted.resize(this->outputCols * 3);
+}
+
+void MashiroDownsampler::feed(int y, const uint8_t * row) noexcept {
+    if (this->nearest) {
+        if (!this->wants(y)) return;
+        for (int c = 0; c < this->outputCols; c++) {
+            const uint8_t * pixel = row + this->sampleCols[c] * 3;
+            this->output[c * 3] = pixel[0];
+            this->output[c * 3 + 1] = pixel[1];
+            this->output[c * 3 + 2] = pixel[2];
+        }
+        this->flush();
+        return;
+    }
+    
+    // 不缩小且不转换颜色时直接计入直方图
+    if (this->outputCols == this->cols && this->outputRows == this->rows && this->convertColor == -1) {
+        for (int x = 0; x < this->cols; x++) {
+            this->histogram.add(row[x * 3 + 2], row[x * 3 + 1], row[x * 3]);
+        }
+        return;
+    }
+    
+    for (int x = 0; x < this->cols; x++) {
+        uint32_t * sum = this->sums.data() + this->columnOf[x] * 3;
+        sum[0] += row[x * 3];
+        sum[1] += row[x * 3 + 1];
+        sum[2] += row[x * 3 + 2];
+    }
+    this->accumulated++;
+    
+    // 这一块的最后一行
+    if (y + 1 == this->rows || this->band(y + 1) != this->band(y)) {
+        for (int c = 0; c < this->outputCols; c++) {
+            uint32_t area = this->columnWidth[c] * this->accumulated;
+            for (int k = 0; k < 3; k++) {
+                this->output[c * 3 + k] = static_cast<uint8_t>((this->sums[c * 3 + k] + area / 2) / area);
+            }
+        }
+        fill(this->sums.begin(), this->sums.end(), 0);
+        this->accumulated = 0;
+        this->flush();
+    }
+}
+
+void MashiroDownsampler::flush() noexcept {
+    // OpenCV里是按照BGR排列的
+    const uint8_t * pixel = this->output.data();
+    Mat converted;
+    if (this->convertColor != -1) {
+        Mat row(1, this->outputCols, CV_8UC3, this->output.data());
+        converted = Mat(1, this->outputCols, CV_8UC3, this->converted.data());
+        cvtColor(row, converted, this->convertColor);
+        pixel = converted.ptr<uint8_t>(0);
+    }
+    for (int c = 0; c < this->outputCols; c++) {
+        this->histogram.add(pixel[c * 3 + 2], pixel[c * 3 + 1], pixel[c * 3]);
+    }
+}
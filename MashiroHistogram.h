@@ -0,0 +1,183 @@
+//
+//  MashiroHistogram.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_HISTOGRAM_H
+#define MASHIRO_HISTOGRAM_H
+
+#include <cstdint>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 颜色直方图, 以24位RGB为键的开放寻址哈希表
+ *
+ *  @discussion clear()只清空用过的位置并保留内存, 重复使用时不会再分配
+ */
+class MashiroHistogram {
+public:
+    /**
+     *  @param capacity 初始容量, 会向上取到2的幂
+     */
+    MashiroHistogram(std::size_t capacity = 1 << 12) noexcept;
+    
+    /**
+     *  @brief 某种颜色出现了count次
+     */
+    void add(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t count = 1) noexcept {
+        std::uint32_t key = occupied | std::uint32_t(r) << 16 | std::uint32_t(g) << 8 | b;
+        std::size_t slot = (key * 0x9E3779B1u) >> this->shift;
+        while (1) {
+            std::uint32_t current = this->keys[slot];
+            if (current == key) {
+                this->counts[slot] += count;
+                return;
+            }
+            if (current == 0) break;
+            slot = (slot + 1) & this->mask;
+        }
+        this->keys[slot] = key;
+        this->counts[slot] = count;
+        this->used.emplace_back(static_cast<std::uint32_t>(slot));
+        if (this->used.size() * 2 > this->keys.size()) this->grow();
+    }
+    
+    /**
+     *  @brief 清空, 保留已分配的内存
+     */
+    void clear() noexcept;
+    
+    /**
+     *  @brief 有多少种颜色
+     */
+    std::size_t size() const noexcept { return this->used.size(); }
+    
+    /**
+     *  @brief 所有像素的个数
+     */
+    std::uint64_t total() const noexcept;
+    
+    /**
+     *  @brief 取出所有颜色及其出现的次数, 按RGB排序
+     *
+     *  @param pixels 输出, 原有内容会被替换, 容量足够时不会重新分配
+     */
+    void colors(std::vector<MashiroColorWithCount>& pixels) noexcept;
+private:
+    /**
+     *  @brief 已占用位置的标记, 使黑色的键也不为0
+     */
+    static constexpr std::uint32_t occupied = 0x80000000u;
+    
+    std::vector<std::uint32_t> keys;
+    std::vector<std::uint32_t> counts;
+    
+    /**
+     *  @brief 已占用的位置, 用于遍历与清空
+     */
+    std::vector<std::uint32_t> used;
+    
+    std::size_t mask;
+    int shift;
+    
+    /**
+     *  @brief 容量翻倍
+     */
+    void grow() noexcept;
+    
+    /**
+     *  @brief 设置容量, 并清空
+     */
+    void reserve(std::size_t capacity) noexcept;
+};
+
+/**
+ *  @brief 边缩小边统计直方图, 不生成缩小后的图像
+ *
+ *  @discussion 逐行输入源图像, 每凑齐一行输出就计入直方图. INTER_AREA对每个块求平均,
+ *              INTER_NEAREST只取每个块中心的像素, 不会产生源图像中没有的颜色,
+ *              并且只需要读取wants()为true的行
+ */
+class MashiroDownsampler {
+public:
+    /**
+     *  @param histogram     输出的直方图
+     *  @param cols          源图像宽度
+     *  @param rows          源图像高度
+     *  @param width         缩小后的宽度, 高度按比例计算, 不大于0或不小于cols时不缩小
+     *  @param interpolation cv::INTER_AREA或cv::INTER_NEAREST
+     *  @param convertColor  对缩小后的像素做的颜色空间转换, -1表示不转换
+     */
+    MashiroDownsampler(MashiroHistogram& histogram, int cols, int rows, int width, int interpolation, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 换一张图重新开始, 参数同构造函数, 已分配的缓冲区会被重复使用
+     */
+    void reset(int cols, int rows, int width, int interpolation, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 第y行是否需要输入
+     */
+    bool wants(int y) const noexcept {
+        return !this->nearest || this->sampleRows[this->band(y)] == y;
+    }
+    
+    /**
+     *  @brief 输入第y行, BGR排列. 行号必须递增, wants()为false的行可以跳过
+     */
+    void feed(int y, const std::uint8_t * row) noexcept;
+    
+    /**
+     *  @brief 缩小后的宽与高
+     */
+    int width() const noexcept { return this->outputCols; }
+    int height() const noexcept { return this->outputRows; }
+private:
+    MashiroHistogram& histogram;
+    int cols, rows;
+    int outputCols, outputRows;
+    bool nearest;
+    int convertColor;
+    
+    /**
+     *  @brief 每一列源像素属于哪一列输出, 以及每一列输出包含几列源像素
+     */
+    std::vector<std::uint32_t> columnOf;
+    std::vector<std::uint32_t> columnWidth;
+    
+    /**
+     *  @brief INTER_NEAREST时每一行/列输出取样的源像素位置
+     */
+    std::vector<int> sampleRows;
+    std::vector<int> sampleCols;
+    
+    /**
+     *  @brief 当前这一行输出的累加值, 以及已经累加了几行
+     */
+    std::vector<std::uint32_t> sums;
+    int accumulated;
+    
+    /**
+     *  @brief 缩小后的一行, 以及颜色空间转换后的一行
+     */
+    std::vector<std::uint8_t> output;
+    std::vector<std::uint8_t> converted;
+    
+    /**
+     *  @brief 第y行源像素属于哪一行输出
+     */
+    int band(int y) const noexcept {
+        return static_cast<int>(static_cast<std::int64_t>(y) * this->outputRows / this->rows);
+    }
+    
+    /**
+     *  @brief 把缩小后的一行计入直方图
+     */
+    void flush() noexcept;
+};
+
+#endif /* MASHIRO_HISTOGRAM_H */
@@ -0,0 +1,108 @@
+//
+//  MashiroHistogramIndex.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroHistogramIndex.h"
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+MashiroHistogramIndex::MashiroHistogramIndex(Mat& image, int _cellSize, int _bits, int convertColor) noexcept {
+    // OpenCV里是按照BGR排列的
+    constexpr int R = 2;
+    constexpr int G = 1;
+    constexpr int B = 0;
+    
+    this->cols = image.cols;
+    this->rows = image.rows;
+    // 每个格子都有完整的直方图, 位数再多内存会按8倍增长
+    this->bits = min(max(_bits, 1), 4);
+    this->bins = 1 << (this->bits * 3);
+    
+    // 网格不超过128x128, 否则前缀和占用的内存太大
+    this->cellSize = _cellSize > 0 ? _cellSize : max(1, (max(this->cols, this->rows) + 127) / 128);
+    this->gridCols = (this->cols + this->cellSize - 1) / this->cellSize;
+    this->gridRows = (this->rows + this->cellSize - 1) / this->cellSize;
+    this->integral.assign(static_cast<size_t>(this->gridRows + 1) * (this->gridCols + 1) * this->bins, 0);
+    
+    vector<double> sums(this->bins * 3, 0);
+    vector<uint64_t> totals(this->bins, 0);
+    int shift = 8 - this->bits;
+    
+    // 先把每个像素计入它所在格子的直方图, 存放在前缀和中右下方的位置
+    Mat converted;
+    for (int i = 0; i < this->rows; i++) {
+        const Vec3b * pixel = image.ptr<Vec3b>(i);
+        if (convertColor != -1) {
+            cvtColor(image(Rect(0, i, this->cols, 1)), converted, convertColor);
+            pixel = converted.ptr<Vec3b>(0);
+        }
+        uint32_t * row = this->integral.data() + static_cast<size_t>(i / this->cellSize + 1) * (this->gridCols + 1) * this->bins;
+        for (int j = 0; j < this->cols; j++) {
+            int bin = (pixel[j][R] >> shift) << (this->bits * 2) | (pixel[j][G] >> shift) << this->bits | (pixel[j][B] >> shift);
+            row[(j / this->cellSize + 1) * this->bins + bin]++;
+            sums[bin * 3 + 0] += pixel[j][R];
+            sums[bin * 3 + 1] += pixel[j][G];
+            sums[bin * 3 + 2] += pixel[j][B];
+            totals[bin]++;
+        }
+    }
+    
+    // 二维前缀和: 先沿行累加, 再加上一行
+    for (int gy = 1; gy <= this->gridRows; gy++) {
+        uint32_t * row = this->integral.data() + static_cast<size_t>(gy) * (this->gridCols + 1) * this->bins;
+        const uint32_t * above = row - (this->gridCols + 1) * this->bins;
+        for (int gx = 1; gx <= this->gridCols; gx++) {
+            uint32_t * cell = row + gx * this->bins;
+            const uint32_t * left = cell - this->bins;
+            for (int b = 0; b < this->bins; b++) {
+                cell[b] += left[b];
+            }
+        }
+        for (int k = 0; k < (this->gridCols + 1) * this->bins; k++) {
+            row[k] += above[k];
+        }
+    }
+    
+    // 每个bin的平均颜色, 没有出现过的bin取其中心
+    this->binColors.reserve(this->bins);
+    for (int b = 0; b < this->bins; b++) {
+        if (totals[b]) {
+            this->binColors.emplace_back(sums[b * 3] / totals[b], sums[b * 3 + 1] / totals[b], sums[b * 3 + 2] / totals[b]);
+        } else {
+            int mask = (1 << this->bits) - 1;
+            double half = (1 << shift) / 2.0;
+            this->binColors.emplace_back(((b >> (this->bits * 2)) << shift) + half, (((b >> this->bits) & mask) << shift) + half, ((b & mask) << shift) + half);
+        }
+    }
+}
+
+vector<MashiroColorWithCount> MashiroHistogramIndex::histogram(int x, int y, int width, int height) const noexcept {
+    vector<MashiroColorWithCount> pixels;
+    
+    // 区域向外对齐到网格上
+    int gx0 = min(max(x, 0), this->cols) / this->cellSize;
+    int gy0 = min(max(y, 0), this->rows) / this->cellSize;
+    int gx1 = (min(max(x + width, 0), this->cols) + this->cellSize - 1) / this->cellSize;
+    int gy1 = (min(max(y + height, 0), this->rows) + this->cellSize - 1) / this->cellSize;
+    if (gx1 <= gx0 || gy1 <= gy0) return pixels;
+    
+    const uint32_t * br = this->at(gy1, gx1);
+    const uint32_t * tr = this->at(gy0, gx1);
+    const uint32_t * bl = this->at(gy1, gx0);
+    const uint32_t * tl = this->at(gy0, gx0);
+    for (int b = 0; b < this->bins; b++) {
+        uint32_t count = br[b] - tr[b] - bl[b] + tl[b];
+        if (count) pixels.emplace_back(this->binColors[b], count);
+    }
+    return pixels;
+}
+
+Cluster MashiroHistogramIndex::color(int x, int y, int width, int height, std::uint32_t number) const noexcept {
+    return mashiro::kmeans(this->histogram(x, y, width, height), number);
+}
@@ -0,0 +1,92 @@
+//
+//  MashiroHistogramIndex.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_HISTOGRAM_INDEX_H
+#define MASHIRO_HISTOGRAM_INDEX_H
+
+#include <cstdint>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 积分直方图
+ *
+ *  @discussion 把图像划分为网格, 对每个格子统计粗量化后的颜色直方图并做二维前缀和.
+ *              建立一次之后, 任意矩形区域的直方图只需要O(bins)次运算即可取出,
+ *              适合对同一张图的大量子区域(检测框, 版面网格等)求主要颜色
+ */
+class MashiroHistogramIndex {
+public:
+    /**
+     *  @brief 为一张图建立积分直方图
+     *
+     *  @param image        源图片, BGR
+     *  @param cellSize     网格的边长(像素), 0表示自动选择, 使网格不超过128x128
+     *  @param bits         每个颜色分量量化后保留的位数, 共(1 << bits * 3)个bin, 取值1到4,
+     *                      超过4时按4处理, 128x128的网格在4位时前缀和已经占用约270MB
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     */
+    MashiroHistogramIndex(cv::Mat& image, int cellSize = 0, int bits = 3, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 取出矩形区域内的颜色及其出现的次数
+     *
+     *  @discussion 区域会向外对齐到网格上. 每个bin的颜色为该bin在整张图上的平均颜色
+     *
+     *  @return 区域内的颜色及其出现的次数, 可以直接交给mashiro::kmeans
+     */
+    std::vector<MashiroColorWithCount> histogram(int x, int y, int width, int height) const noexcept;
+    
+    /**
+     *  @brief 求矩形区域的主要颜色
+     *
+     *  @param number 需要几种主要颜色
+     *
+     *  @return 聚类后的颜色
+     */
+    Cluster color(int x, int y, int width, int height, std::uint32_t number) const noexcept;
+    
+    /**
+     *  @brief 网格的边长(像素)
+     */
+    int cell() const noexcept { return cellSize; }
+private:
+    /**
+     *  @brief 原图的宽与高
+     */
+    int cols, rows;
+    
+    /**
+     *  @brief 网格的边长, 以及横竖各有多少格
+     */
+    int cellSize, gridCols, gridRows;
+    
+    /**
+     *  @brief 量化位数与bin的个数
+     */
+    int bits, bins;
+    
+    /**
+     *  @brief 前缀和, (gridRows + 1) x (gridCols + 1) x bins, 同一格的bin连续存放
+     */
+    std::vector<std::uint32_t> integral;
+    
+    /**
+     *  @brief 每个bin在整张图上的平均颜色
+     */
+    std::vector<MashiroColor> binColors;
+    
+    /**
+     *  @brief 第(gy, gx)格的前缀和的起始位置
+     */
+    const std::uint32_t * at(int gy, int gx) const noexcept {
+        return integral.data() + (static_cast<std::size_t>(gy) * (gridCols + 1) + gx) * bins;
+    }
+};
+
+#endif /* MASHIRO_HISTOGRAM_INDEX_H */
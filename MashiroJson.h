@@ -0,0 +1,25 @@
+//
+//  MashiroJson.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_JSON_H
+#define MASHIRO_JSON_H
+
+#include <string>
+
+/**
+ *  @brief 输出JSON时用到的辅助函数
+ */
+class MashiroJson {
+public:
+    /**
+     *  @brief 按JSON字符串的规则转义, 并加上两边的引号
+     */
+    static std::string quote(const std::string& text) noexcept;
+};
+
+#endif /* MASHIRO_JSON_H */
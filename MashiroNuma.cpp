@@ -0,0 +1,92 @@
+//
+//  MashiroNuma.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroNuma.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+/**
+ *  @brief 解析"0-3,8-11"形式的CPU列表
+ */
+static vector<int> parseList(const string& list) noexcept {
+    vector<int> cpus;
+    stringstream input(list);
+    string item;
+    while (getline(input, item, ',')) {
+        int first, last;
+        if (sscanf(item.c_str(), "%d-%d", &first, &last) == 2) {
+            for (int cpu = first; cpu <= last; cpu++) cpus.emplace_back(cpu);
+        } else if (sscanf(item.c_str(), "%d", &first) == 1) {
+            cpus.emplace_back(first);
+        }
+    }
+    return cpus;
+}
+
+vector<MashiroNumaNode> MashiroNuma::nodes() noexcept {
+    // 当前进程允许使用的CPU
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto usable = [&](int cpu) { return !restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+    
+    vector<MashiroNumaNode> nodes;
+    if (DIR * dir = opendir("/sys/devices/system/node")) {
+        while (struct dirent * entry = readdir(dir)) {
+            int id;
+            if (sscanf(entry->d_name, "node%d", &id) != 1) continue;
+            ifstream file(string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            string list;
+            getline(file, list);
+            MashiroNumaNode node { id, {} };
+            for (int cpu : parseList(list)) {
+                if (usable(cpu)) node.cpus.emplace_back(cpu);
+            }
+            if (!node.cpus.empty()) nodes.emplace_back(node);
+        }
+        closedir(dir);
+    }
+    sort(nodes.begin(), nodes.end(), [](const MashiroNumaNode& a, const MashiroNumaNode& b) { return a.id < b.id; });
+    
+    // 没有NUMA信息时, 所有CPU属于同一个节点
+    if (nodes.empty()) {
+        MashiroNumaNode node { 0, {} };
+        int count = static_cast<int>(max(1u, thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < count; cpu++) {
+            if (usable(cpu)) node.cpus.emplace_back(cpu);
+        }
+        nodes.emplace_back(node);
+    }
+    return nodes;
+}
+
+vector<int> MashiroNuma::assign(uint32_t threads) noexcept {
+    vector<MashiroNumaNode> nodes = MashiroNuma::nodes();
+    vector<int> cpus(threads, -1);
+    for (uint32_t i = 0; i < threads; i++) {
+        const MashiroNumaNode& node = nodes[i % nodes.size()];
+        if (!node.cpus.empty()) cpus[i] = node.cpus[(i / nodes.size()) % node.cpus.size()];
+    }
+    return cpus;
+}
+
+bool MashiroNuma::pin(int cpu) noexcept {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,57 @@
+//
+//  MashiroNuma.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_NUMA_H
+#define MASHIRO_NUMA_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ *  @brief 一个NUMA节点及其CPU
+ */
+struct MashiroNumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+/**
+ *  @brief NUMA拓扑与线程绑定
+ *
+ *  @discussion 拓扑从/sys/devices/system/node读取, 只包含当前进程允许使用的CPU.
+ *              读不到时视为只有一个节点. 内存按Linux默认的首次访问策略分配在访问它的线程所在的节点,
+ *              所以线程先绑定到CPU, 再分配并第一次写入自己的缓冲区, 缓冲区就在本地节点上
+ */
+class MashiroNuma {
+public:
+    /**
+     *  @brief 所有有CPU的节点
+     */
+    static std::vector<MashiroNumaNode> nodes() noexcept;
+    
+    /**
+     *  @brief 为每个工作线程分配一个CPU
+     *
+     *  @discussion 线程轮流分到各个节点, 在节点内依次使用各个CPU,
+     *              使线程在节点之间均匀分布
+     *
+     *  @param threads 线程数
+     *
+     *  @return 第i个线程使用的CPU
+     */
+    static std::vector<int> assign(std::uint32_t threads) noexcept;
+    
+    /**
+     *  @brief 把当前线程绑定到一个CPU
+     *
+     *  @return 是否成功
+     */
+    static bool pin(int cpu) noexcept;
+};
+
+#endif /* MASHIRO_NUMA_H */
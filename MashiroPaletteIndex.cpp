@@ -0,0 +1,309 @@
+//
+//  MashiroPaletteIndex.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroPaletteIndex.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MashiroBatch.h"
+#include "MashiroResultFile.h"
+
+using namespace std;
+
+static constexpr char indexMagic[8] = { 'M', 'S', 'H', 'R', 'P', 'I', 'D', 'X' };
+static constexpr uint32_t indexVersion = 1;
+
+/**
+ *  @brief 向上对齐到8字节
+ */
+static uint64_t align8(uint64_t offset) noexcept {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+/**
+ *  @brief 从offset开始的count个unit字节的区域是否完全在size字节之内, 乘法溢出也视为越界
+ */
+static bool inside(uint64_t offset, uint64_t count, uint64_t unit, uint64_t size) noexcept {
+    if (offset > size) return false;
+    return count <= (size - offset) / unit;
+}
+
+/**
+ *  @brief 调色板的加权平均颜色
+ */
+static void mean(const MashiroPaletteRecord& record, float rgb[3]) noexcept {
+    float total = 0;
+    rgb[0] = rgb[1] = rgb[2] = 0;
+    for (int i = 0; i < record.count; i++) {
+        for (int c = 0; c < 3; c++) rgb[c] += record.colors[i][c] * float(record.weights[i]);
+        total += record.weights[i];
+    }
+    if (total > 0) {
+        for (int c = 0; c < 3; c++) rgb[c] /= total;
+    }
+}
+
+MashiroPaletteIndex::MashiroPaletteIndex(const string& path) noexcept : mapping(nullptr), length(0), header(nullptr), characters(0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MashiroPaletteIndexHeader)) {
+        close(fd);
+        return;
+    }
+    this->length = info.st_size;
+    void * mapped = mmap(NULL, this->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return;
+    this->mapping = mapped;
+    
+    // 检查文件头, 不认识的文件不使用
+    const MashiroPaletteIndexHeader * h = static_cast<const MashiroPaletteIndexHeader *>(mapped);
+    if (memcmp(h->magic, indexMagic, sizeof(indexMagic)) != 0 || h->version != indexVersion || h->size != this->length || h->lists == 0) return;
+    
+    // 各区按写入时的顺序排列且对齐, 都必须在文件之内
+    if (h->centroidsOffset < sizeof(MashiroPaletteIndexHeader) || (h->centroidsOffset | h->listsOffset | h->recordsOffset | h->namesOffset) % 8 != 0) return;
+    if (!inside(h->centroidsOffset, uint64_t(h->lists) * 3, sizeof(float), h->listsOffset) ||
+        !inside(h->listsOffset, uint64_t(h->lists) + 1, sizeof(uint64_t), h->recordsOffset) ||
+        h->count > this->length / sizeof(MashiroPaletteRecord) ||
+        !inside(h->recordsOffset, h->count, sizeof(MashiroPaletteRecord), h->namesOffset) ||
+        !inside(h->namesOffset, h->count + 1, sizeof(uint64_t), this->length)) return;
+    const uint8_t * base = static_cast<const uint8_t *>(mapped);
+    
+    // 列表的范围必须递增且不超过调色板个数
+    const uint64_t * lists = reinterpret_cast<const uint64_t *>(base + h->listsOffset);
+    if (lists[0] != 0 || lists[h->lists] != h->count) return;
+    for (uint32_t i = 0; i < h->lists; i++) {
+        if (lists[i] > lists[i + 1]) return;
+    }
+    
+    // 字符区从偏移表之后到文件末尾, 所有路径都以'\0'结尾
+    const uint64_t * names = reinterpret_cast<const uint64_t *>(base + h->namesOffset);
+    uint64_t characters = this->length - (h->namesOffset + (h->count + 1) * sizeof(uint64_t));
+    if (names[h->count] != characters || (characters > 0 && base[this->length - 1] != '\0')) return;
+    
+    this->centroids = reinterpret_cast<const float *>(base + h->centroidsOffset);
+    this->listOffsets = lists;
+    this->records = reinterpret_cast<const MashiroPaletteRecord *>(base + h->recordsOffset);
+    this->nameOffsets = names;
+    this->characters = characters;
+    this->header = h;
+    madvise(mapped, this->length, MADV_RANDOM);
+}
+
+MashiroPaletteIndex::~MashiroPaletteIndex() noexcept {
+    if (this->mapping) munmap(this->mapping, this->length);
+}
+
+vector<MashiroPaletteMatch> MashiroPaletteIndex::search(const Cluster& colors, const vector<uint32_t>& weights, size_t n, uint32_t probes) const noexcept {
+    vector<MashiroPaletteMatch> matches;
+    if (!this->header || n == 0 || colors.empty()) return matches;
+    
+    MashiroPaletteRecord query = MashiroPaletteIndex::quantize(0, colors, weights);
+    float center[3];
+    mean(query, center);
+    
+    // 找出平均颜色最近的probes个列表
+    uint32_t lists = this->header->lists;
+    vector<pair<float, uint32_t>> nearest(lists);
+    for (uint32_t i = 0; i < lists; i++) {
+        const float * centroid = this->centroids + i * 3;
+        float d = 0;
+        for (int c = 0; c < 3; c++) d += (centroid[c] - center[c]) * (centroid[c] - center[c]);
+        nearest[i] = make_pair(d, i);
+    }
+    probes = min(max(probes, 1u), lists);
+    partial_sort(nearest.begin(), nearest.begin() + probes, nearest.end());
+    
+    // 用大顶堆保留距离最小的n个
+    auto farther = [](const MashiroPaletteMatch& a, const MashiroPaletteMatch& b) { return a.distance < b.distance; };
+    priority_queue<MashiroPaletteMatch, vector<MashiroPaletteMatch>, decltype(farther)> best(farther);
+    for (uint32_t p = 0; p < probes; p++) {
+        uint32_t list = nearest[p].second;
+        for (uint64_t i = this->listOffsets[list]; i < this->listOffsets[list + 1]; i++) {
+            double d = MashiroPaletteIndex::distance(query, this->records[i]);
+            if (best.size() < n) {
+                best.push(MashiroPaletteMatch{ this->records[i].id, d });
+            } else if (d < best.top().distance) {
+                best.pop();
+                best.push(MashiroPaletteMatch{ this->records[i].id, d });
+            }
+        }
+    }
+    
+    matches.resize(best.size());
+    for (size_t i = matches.size(); i > 0; i--) {
+        matches[i - 1] = best.top();
+        best.pop();
+    }
+    return matches;
+}
+
+const char * MashiroPaletteIndex::name(uint32_t id) const noexcept {
+    if (!this->header || id >= this->header->count || this->nameOffsets[id] >= this->characters) return nullptr;
+    const char * names = reinterpret_cast<const char *>(this->nameOffsets + this->header->count + 1);
+    return names + this->nameOffsets[id];
+}
+
+double MashiroPaletteIndex::distance(const MashiroPaletteRecord& a, const MashiroPaletteRecord& b) noexcept {
+    // a中每种颜色到b中最近颜色的加权平均距离, 损坏的记录最多只读maxColors种颜色
+    auto directed = [](const MashiroPaletteRecord& from, const MashiroPaletteRecord& to) {
+        float sum = 0, total = 0;
+        int fromCount = min<int>(from.count, MashiroPaletteRecord::maxColors);
+        int toCount = min<int>(to.count, MashiroPaletteRecord::maxColors);
+        for (int i = 0; i < fromCount; i++) {
+            int smallest = INT32_MAX;
+            for (int j = 0; j < toCount; j++) {
+                int dr = from.colors[i][0] - to.colors[j][0];
+                int dg = from.colors[i][1] - to.colors[j][1];
+                int db = from.colors[i][2] - to.colors[j][2];
+                smallest = min(smallest, dr * dr + dg * dg + db * db);
+            }
+            sum += from.weights[i] * sqrtf(float(smallest));
+            total += from.weights[i];
+        }
+        return total > 0 ? sum / total : 0.0f;
+    };
+    if (a.count == 0 || b.count == 0) return DBL_MAX;
+    return (directed(a, b) + directed(b, a)) / 2.0;
+}
+
+MashiroPaletteRecord MashiroPaletteIndex::quantize(uint32_t id, const Cluster& colors, const vector<uint32_t>& weights) noexcept {
+    MashiroPaletteRecord record;
+    memset(&record, 0, sizeof(record));
+    record.id = id;
+    
+    // 只保留权重最大的maxColors种颜色
+    vector<size_t> order(colors.size());
+    iota(order.begin(), order.end(), 0);
+    auto weight = [&weights](size_t i) { return i < weights.size() ? double(weights[i]) : 1.0; };
+    stable_sort(order.begin(), order.end(), [&weight](size_t a, size_t b) { return weight(a) > weight(b); });
+    if (order.size() > MashiroPaletteRecord::maxColors) order.resize(MashiroPaletteRecord::maxColors);
+    
+    double total = 0;
+    for (size_t i : order) total += weight(i);
+    if (total <= 0) total = 1;
+    
+    record.count = static_cast<uint8_t>(order.size());
+    for (size_t k = 0; k < order.size(); k++) {
+        for (int c = 0; c < 3; c++) {
+            record.colors[k][c] = static_cast<uint8_t>(min(max(colors[order[k]][c] + 0.5, 0.0), 255.0));
+        }
+        record.weights[k] = static_cast<uint8_t>(min(255.0, weight(order[k]) * 255.0 / total + 0.5));
+    }
+    return record;
+}
+
+bool MashiroPaletteIndex::build(const string& input, const string& output, uint32_t lists) noexcept {
+    // 读入批量模式的输出, 文本格式或二进制的结果文件. 没有颜色的行被跳过,
+    // 所以id是调色板在索引中的序号, 出现空行之后就不再等于行号, 路径要用name(id)取
+    vector<MashiroPaletteRecord> records;
+    string names;
+    vector<uint64_t> nameOffsets;
+    string path;
+    Cluster colors;
+    vector<uint32_t> weights;
+    auto append = [&]() {
+        records.emplace_back(MashiroPaletteIndex::quantize(static_cast<uint32_t>(records.size()), colors, weights));
+        nameOffsets.emplace_back(names.size());
+        names.append(path).push_back('\0');
+    };
+    if (MashiroResultFile::recognize(input)) {
+        MashiroResultFile results(input);
+        if (!results.valid()) return false;
+        for (size_t i = 0; i < results.size(); i++) {
+            results.get(i, colors, weights);
+            if (colors.empty()) continue;
+            path = results.name(i);
+            append();
+        }
+    } else {
+        ifstream batch(input);
+        if (!batch) return false;
+        string line;
+        while (getline(batch, line)) {
+            if (!MashiroBatch::parse(line, path, colors, weights) || colors.empty()) continue;
+            append();
+        }
+    }
+    nameOffsets.emplace_back(names.size());
+    if (records.empty()) return false;
+    
+    // 用平均颜色的直方图训练粗聚类中心, 平均颜色按8对齐以减少点数
+    if (lists == 0) lists = static_cast<uint32_t>(sqrt(double(records.size())));
+    lists = min(max(lists, 1u), 65536u);
+    map<MashiroColor, uint32_t> histogram;
+    vector<array<float, 3>> means(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        mean(records[i], means[i].data());
+        histogram[MashiroColor(floor(means[i][0] / 8) * 8 + 4, floor(means[i][1] / 8) * 8 + 4, floor(means[i][2] / 8) * 8 + 4)]++;
+    }
+    Cluster centers = mashiro::kmeans(vector<MashiroColorWithCount>(histogram.cbegin(), histogram.cend()), lists);
+    lists = static_cast<uint32_t>(centers.size());
+    
+    // 把每个调色板分到最近的列表, 再按列表排序
+    vector<uint32_t> assignment(records.size());
+    vector<uint64_t> listOffsets(lists + 1, 0);
+    for (size_t i = 0; i < records.size(); i++) {
+        float smallest = FLT_MAX;
+        for (uint32_t l = 0; l < lists; l++) {
+            float d = 0;
+            for (int c = 0; c < 3; c++) d += (float(centers[l][c]) - means[i][c]) * (float(centers[l][c]) - means[i][c]);
+            if (d < smallest) {
+                smallest = d;
+                assignment[i] = l;
+            }
+        }
+        listOffsets[assignment[i] + 1]++;
+    }
+    partial_sum(listOffsets.begin(), listOffsets.end(), listOffsets.begin());
+    vector<MashiroPaletteRecord> sorted(records.size());
+    vector<uint64_t> cursor(listOffsets.begin(), listOffsets.end() - 1);
+    for (size_t i = 0; i < records.size(); i++) {
+        sorted[cursor[assignment[i]]++] = records[i];
+    }
+    
+    vector<float> centroids;
+    for (const auto& center : centers) {
+        centroids.insert(centroids.end(), { float(center[0]), float(center[1]), float(center[2]) });
+    }
+    
+    MashiroPaletteIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.version = indexVersion;
+    header.lists = lists;
+    header.count = records.size();
+    header.centroidsOffset = align8(sizeof(header));
+    header.listsOffset = align8(header.centroidsOffset + centroids.size() * sizeof(float));
+    header.recordsOffset = align8(header.listsOffset + listOffsets.size() * sizeof(uint64_t));
+    header.namesOffset = align8(header.recordsOffset + sorted.size() * sizeof(MashiroPaletteRecord));
+    header.size = header.namesOffset + nameOffsets.size() * sizeof(uint64_t) + names.size();
+    
+    ofstream file(output, ios::binary | ios::trunc);
+    auto write = [&file](uint64_t offset, const void * data, size_t size) {
+        static const char padding[8] = {};
+        file.write(padding, offset - uint64_t(file.tellp()));
+        file.write(static_cast<const char *>(data), size);
+    };
+    write(0, &header, sizeof(header));
+    write(header.centroidsOffset, centroids.data(), centroids.size() * sizeof(float));
+    write(header.listsOffset, listOffsets.data(), listOffsets.size() * sizeof(uint64_t));
+    write(header.recordsOffset, sorted.data(), sorted.size() * sizeof(MashiroPaletteRecord));
+    write(header.namesOffset, nameOffsets.data(), nameOffsets.size() * sizeof(uint64_t));
+    file.write(names.data(), names.size());
+    return bool(file);
+}
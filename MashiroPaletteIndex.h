@@ -0,0 +1,138 @@
+//
+//  MashiroPaletteIndex.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_PALETTE_INDEX_H
+#define MASHIRO_PALETTE_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 索引文件头
+ */
+struct MashiroPaletteIndexHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t lists;
+    std::uint64_t count;
+    std::uint64_t centroidsOffset;
+    std::uint64_t listsOffset;
+    std::uint64_t recordsOffset;
+    std::uint64_t namesOffset;
+    std::uint64_t size;
+};
+
+/**
+ *  @brief 索引中的一个调色板, 定长40字节
+ *
+ *  @discussion 颜色量化为8位RGB, 权重量化为和为255的8位整数
+ */
+struct MashiroPaletteRecord {
+    static constexpr int maxColors = 8;
+    
+    std::uint32_t id;
+    std::uint8_t count;
+    std::uint8_t reserved[3];
+    std::uint8_t colors[maxColors][3];
+    std::uint8_t weights[maxColors];
+};
+
+/**
+ *  @brief 查询结果
+ */
+struct MashiroPaletteMatch {
+    /**
+     *  @brief 调色板的序号, 用MashiroPaletteIndex::name取得路径
+     */
+    std::uint32_t id;
+    double distance;
+};
+
+/**
+ *  @brief 内存映射的调色板索引, 用于在大量图片中查找颜色相近的图片
+ *
+ *  @discussion IVF结构: 按调色板的加权平均颜色把所有调色板分到若干个列表中,
+ *              查询时只扫描平均颜色最近的几个列表, 再用调色板之间的距离精确排序
+ */
+class MashiroPaletteIndex {
+public:
+    /**
+     *  @brief 映射一个索引文件
+     */
+    MashiroPaletteIndex(const std::string& path) noexcept;
+    ~MashiroPaletteIndex() noexcept;
+    
+    MashiroPaletteIndex(const MashiroPaletteIndex&) = delete;
+    MashiroPaletteIndex& operator=(const MashiroPaletteIndex&) = delete;
+    
+    /**
+     *  @brief 文件是否成功映射
+     */
+    bool valid() const noexcept { return this->header != nullptr; }
+    
+    /**
+     *  @brief 索引中有多少个调色板
+     */
+    std::uint64_t size() const noexcept { return this->header ? this->header->count : 0; }
+    
+    /**
+     *  @brief 查找与给定调色板最相近的n个调色板
+     *
+     *  @param colors  调色板
+     *  @param weights 每种颜色的权重, 为空时视为相等
+     *  @param n       返回多少个结果
+     *  @param probes  扫描多少个列表, 越大越准确
+     *
+     *  @return 按距离从小到大排列的结果
+     */
+    std::vector<MashiroPaletteMatch> search(const Cluster& colors, const std::vector<std::uint32_t>& weights, std::size_t n, std::uint32_t probes = 8) const noexcept;
+    
+    /**
+     *  @brief 第id个调色板对应的图片路径
+     *
+     *  @discussion id是建立索引时调色板的序号, 没有颜色的行不占序号, 所以不一定等于输入的行号
+     */
+    const char * name(std::uint32_t id) const noexcept;
+    
+    /**
+     *  @brief 两个调色板之间的距离
+     *
+     *  @discussion 双向加权平均最近距离: 每种颜色到另一个调色板中最近颜色的距离,
+     *              按权重平均后取两个方向的平均值
+     */
+    static double distance(const MashiroPaletteRecord& a, const MashiroPaletteRecord& b) noexcept;
+    
+    /**
+     *  @brief 把调色板量化为索引中的格式
+     */
+    static MashiroPaletteRecord quantize(std::uint32_t id, const Cluster& colors, const std::vector<std::uint32_t>& weights) noexcept;
+    
+    /**
+     *  @brief 从批量模式的输出建立索引
+     *
+     *  @param input  批量模式的输出, MashiroBatch::format的文本或MashiroResultWriter写出的结果文件
+     *  @param output 索引文件
+     *  @param lists  列表个数, 0表示取调色板个数的平方根
+     *
+     *  @return 是否成功
+     */
+    static bool build(const std::string& input, const std::string& output, std::uint32_t lists = 0) noexcept;
+private:
+    void * mapping;
+    std::size_t length;
+    const MashiroPaletteIndexHeader * header;
+    const float * centroids;
+    const std::uint64_t * listOffsets;
+    const MashiroPaletteRecord * records;
+    const std::uint64_t * nameOffsets;
+    std::uint64_t characters;
+};
+
+#endif /* MASHIRO_PALETTE_INDEX_H */
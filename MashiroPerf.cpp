@@ -0,0 +1,174 @@
+//
+//  MashiroPerf.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroPerf.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+atomic<bool> MashiroPerf::flag(false);
+
+/**
+ *  @brief 一个线程的计数器组与统计结果
+ */
+class MashiroPerfThread {
+public:
+    MashiroPerfReport report;
+    
+    MashiroPerfThread() noexcept {
+        for (int& fd : this->fds) fd = -1;
+#ifdef __linux__
+        static const uint64_t events[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < 4; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            this->fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : this->fds[0], 0));
+            if (this->fds[i] < 0) {
+                this->close();
+                return;
+            }
+        }
+        ioctl(this->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    
+    ~MashiroPerfThread() noexcept {
+        this->close();
+    }
+    
+    bool available() const noexcept {
+        return this->fds[0] >= 0;
+    }
+    
+    /**
+     *  @brief 读出当前的计数
+     *
+     *  @return 硬件计数器是否读取成功, 耗时总是有效
+     */
+    bool read(MashiroPerfCounters& counters) const noexcept {
+        counters.nanoseconds = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+        if (!this->available()) return false;
+        
+        // PERF_FORMAT_GROUP: 事件个数, 之后按打开的顺序排列
+        uint64_t values[5];
+        if (::read(this->fds[0], values, sizeof(values)) != sizeof(values) || values[0] != 4) return false;
+        counters.cycles = values[1];
+        counters.instructions = values[2];
+        counters.cacheMisses = values[3];
+        counters.branchMisses = values[4];
+        return true;
+    }
+private:
+    int fds[4];
+    
+    void close() noexcept {
+        for (int& fd : this->fds) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+/**
+ *  @brief 当前线程的计数器, 第一次用到时才打开
+ */
+static MashiroPerfThread& current() noexcept {
+    thread_local MashiroPerfThread instance;
+    return instance;
+}
+
+MashiroPerfCounters& MashiroPerfCounters::operator+=(const MashiroPerfCounters& other) noexcept {
+    this->cycles += other.cycles;
+    this->instructions += other.instructions;
+    this->cacheMisses += other.cacheMisses;
+    this->branchMisses += other.branchMisses;
+    this->nanoseconds += other.nanoseconds;
+    this->calls += other.calls;
+    return *this;
+}
+
+MashiroPerfReport& operator+=(MashiroPerfReport& report, const MashiroPerfReport& other) noexcept {
+    for (size_t i = 0; i < report.size(); i++) report[i] += other[i];
+    return report;
+}
+
+void MashiroPerf::enable(bool on) noexcept {
+    MashiroPerf::flag.store(on, memory_order_relaxed);
+}
+
+bool MashiroPerf::available() noexcept {
+    return current().available();
+}
+
+void MashiroPerf::reset() noexcept {
+    current().report = MashiroPerfReport();
+}
+
+MashiroPerfReport MashiroPerf::collect() noexcept {
+    MashiroPerfReport report = current().report;
+    current().report = MashiroPerfReport();
+    return report;
+}
+
+void MashiroPerf::merge(const MashiroPerfReport& report) noexcept {
+    current().report += report;
+}
+
+const char * MashiroPerf::name(MashiroPerfStage stage) noexcept {
+    static const char * names[] = { "decode", "resize", "pixels", "kmeans" };
+    return stage < MashiroPerfStages ? names[stage] : "unknown";
+}
+
+string MashiroPerf::json(const MashiroPerfReport& report) noexcept {
+    ostringstream output;
+    output<<'{';
+    for (uint32_t i = 0; i < MashiroPerfStages; i++) {
+        const MashiroPerfCounters& counters = report[i];
+        if (i) output<<',';
+        output<<'"'<<MashiroPerf::name(MashiroPerfStage(i))<<"\":{\"calls\":"<<counters.calls<<",\"ns\":"<<counters.nanoseconds;
+        output<<",\"cycles\":"<<counters.cycles<<",\"instructions\":"<<counters.instructions;
+        output<<",\"cache_misses\":"<<counters.cacheMisses<<",\"branch_misses\":"<<counters.branchMisses<<'}';
+    }
+    output<<'}';
+    return output.str();
+}
+
+MashiroPerfScope::MashiroPerfScope(MashiroPerfStage _stage) noexcept : stage(_stage), active(MashiroPerf::enabled()) {
+    if (this->active) this->counted = current().read(this->start);
+}
+
+MashiroPerfScope::~MashiroPerfScope() noexcept {
+    if (!this->active) return;
+    MashiroPerfThread& thread = current();
+    MashiroPerfCounters end;
+    bool counted = thread.read(end) && this->counted;
+    
+    MashiroPerfCounters& counters = thread.report[this->stage];
+    counters.nanoseconds += end.nanoseconds - this->start.nanoseconds;
+    counters.calls++;
+    if (!counted) return;
+    counters.cycles += end.cycles - this->start.cycles;
+    counters.instructions += end.instructions - this->start.instructions;
+    counters.cacheMisses += end.cacheMisses - this->start.cacheMisses;
+    counters.branchMisses += end.branchMisses - this->start.branchMisses;
+}
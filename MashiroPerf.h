@@ -0,0 +1,137 @@
+//
+//  MashiroPerf.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_PERF_H
+#define MASHIRO_PERF_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ *  @brief 统计的阶段
+ */
+enum MashiroPerfStage : std::uint32_t {
+    /**
+     *  @brief 解码图片
+     */
+    MashiroPerfDecode = 0,
+    
+    /**
+     *  @brief mashiro::resize
+     */
+    MashiroPerfResize,
+    
+    /**
+     *  @brief 统计直方图, 包括边缩小边统计的情况
+     */
+    MashiroPerfPixels,
+    
+    /**
+     *  @brief kmeans迭代
+     */
+    MashiroPerfKMeans,
+    
+    MashiroPerfStages
+};
+
+/**
+ *  @brief 一个阶段的硬件计数器
+ */
+struct MashiroPerfCounters {
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cacheMisses = 0;
+    std::uint64_t branchMisses = 0;
+    std::uint64_t nanoseconds = 0;
+    std::uint64_t calls = 0;
+    
+    MashiroPerfCounters& operator+=(const MashiroPerfCounters& other) noexcept;
+};
+
+/**
+ *  @brief 每个阶段的计数器
+ */
+using MashiroPerfReport = std::array<MashiroPerfCounters, MashiroPerfStages>;
+
+MashiroPerfReport& operator+=(MashiroPerfReport& report, const MashiroPerfReport& other) noexcept;
+
+/**
+ *  @brief 用perf_event_open统计各阶段的周期数, 指令数, cache miss与分支预测失败
+ *
+ *  @discussion 计数器按线程打开, 只统计调用线程自身, 不包括它启动的其他线程, mashiro::parallel的工作线程除外.
+ *              没有打开时每个阶段只多一次原子读. 无法使用计数器时(内核不支持或权限不足)
+ *              仍然统计耗时, 计数器为0. 阶段嵌套时外层包含内层
+ */
+class MashiroPerf {
+public:
+    /**
+     *  @brief 打开或关闭统计
+     */
+    static void enable(bool on) noexcept;
+    
+    /**
+     *  @brief 是否正在统计
+     */
+    static bool enabled() noexcept {
+        return MashiroPerf::flag.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     *  @brief 当前线程能否使用硬件计数器
+     */
+    static bool available() noexcept;
+    
+    /**
+     *  @brief 清空当前线程的统计
+     */
+    static void reset() noexcept;
+    
+    /**
+     *  @brief 取出当前线程的统计并清空
+     */
+    static MashiroPerfReport collect() noexcept;
+    
+    /**
+     *  @brief 把其他线程取出的统计累加到当前线程
+     */
+    static void merge(const MashiroPerfReport& report) noexcept;
+    
+    /**
+     *  @brief 阶段的名字
+     */
+    static const char * name(MashiroPerfStage stage) noexcept;
+    
+    /**
+     *  @brief 格式化为一个JSON对象, 以阶段名为键
+     */
+    static std::string json(const MashiroPerfReport& report) noexcept;
+private:
+    friend class MashiroPerfScope;
+    static std::atomic<bool> flag;
+};
+
+/**
+ *  @brief 统计一个作用域, 结束时累加到当前线程的统计中
+ */
+class MashiroPerfScope {
+public:
+    MashiroPerfScope(MashiroPerfStage stage) noexcept;
+    ~MashiroPerfScope() noexcept;
+    
+    MashiroPerfScope(const MashiroPerfScope&) = delete;
+    MashiroPerfScope& operator=(const MashiroPerfScope&) = delete;
+private:
+    MashiroPerfStage stage;
+    bool active;
+    bool counted;
+    MashiroPerfCounters start;
+};
+
+#endif /* MASHIRO_PERF_H */
@@ -0,0 +1,174 @@
+//
+//  MashiroRemap.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroRemap.h"
+#include <cstring>
+#include <opencv2/opencv.hpp>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MASHIRO_REMAP_AVX2 1
+#endif
+
+using namespace cv;
+using namespace std;
+
+/**
+ *  @brief 4x4 Bayer矩阵
+ */
+static constexpr int bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+MashiroRemap::MashiroRemap(const Cluster& palette) noexcept {
+    size_t count = min<size_t>(max<size_t>(palette.size(), 1), 256);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t r = i < palette.size() ? static_cast<uint32_t>(min(max(palette[i][0] + 0.5, 0.0), 255.0)) : 0;
+        uint32_t g = i < palette.size() ? static_cast<uint32_t>(min(max(palette[i][1] + 0.5, 0.0), 255.0)) : 0;
+        uint32_t b = i < palette.size() ? static_cast<uint32_t>(min(max(palette[i][2] + 0.5, 0.0), 255.0)) : 0;
+        this->bgrx.emplace_back(b | g << 8 | r << 16);
+    }
+    
+    // 每个量化格的中心找最近的调色板颜色
+    this->lut.assign((1 << 15) + 3, 0);
+    for (int key = 0; key < (1 << 15); key++) {
+        int r = ((key >> 10) << 3) + 4, g = (((key >> 5) & 31) << 3) + 4, b = ((key & 31) << 3) + 4;
+        int smallest = INT32_MAX;
+        for (size_t i = 0; i < count; i++) {
+            int dr = r - int((this->bgrx[i] >> 16) & 0xFF);
+            int dg = g - int((this->bgrx[i] >> 8) & 0xFF);
+            int db = b - int(this->bgrx[i] & 0xFF);
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < smallest) {
+                smallest = distance;
+                this->lut[key] = static_cast<uint8_t>(i);
+            }
+        }
+    }
+    
+    // 抖动幅度取调色板中相邻颜色平均距离在每个分量上的大小
+    double spread = 0;
+    for (size_t i = 0; i < count; i++) {
+        double nearest = count > 1 ? DBL_MAX : 0;
+        for (size_t j = 0; j < count; j++) {
+            if (i == j) continue;
+            MashiroColor a(this->bgrx[i] >> 16 & 0xFF, this->bgrx[i] >> 8 & 0xFF, this->bgrx[i] & 0xFF);
+            MashiroColor b(this->bgrx[j] >> 16 & 0xFF, this->bgrx[j] >> 8 & 0xFF, this->bgrx[j] & 0xFF);
+            nearest = min(nearest, MashiroColor::euclidean(a, b));
+        }
+        spread += nearest / count;
+    }
+    spread /= sqrt(3.0);
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            this->threshold[y][x] = static_cast<int>((bayer[y][x] + 0.5) / 16.0 * spread - spread / 2);
+        }
+    }
+}
+
+void MashiroRemap::remap(Mat& src, Mat& dest, bool dither, uint32_t threads) const noexcept {
+    if (dest.data != src.data) dest.create(src.rows, src.cols, CV_8UC3);
+    this->remap(src.ptr<uint8_t>(0), src.step[0], dest.ptr<uint8_t>(0), dest.step[0], src.cols, src.rows, dither, threads);
+}
+
+void MashiroRemap::remap(const uint8_t * src, size_t srcStride, uint8_t * dest, size_t destStride, int width, int height, bool dither, uint32_t threads) const noexcept {
+    constexpr int rowsPerTask = 16;
+    
+#if MASHIRO_REMAP_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    static const bool avx2 = false;
+#endif
+    
+    size_t tasks = (height + rowsPerTask - 1) / rowsPerTask;
+    mashiro::parallel(tasks, threads, [&](size_t task, uint32_t worker) {
+        int end = min(height, int(task + 1) * rowsPerTask);
+        for (int y = int(task) * rowsPerTask; y < end; y++) {
+            const uint8_t * srcRow = src + srcStride * y;
+            uint8_t * destRow = dest + destStride * y;
+            int begin = avx2 ? this->remapRowAVX2(srcRow, destRow, width, y, dither) : 0;
+            this->remapRow(srcRow, destRow, begin, width, y, dither);
+        }
+    });
+}
+
+void MashiroRemap::remapRow(const uint8_t * src, uint8_t * dest, int begin, int width, int y, bool dither) const noexcept {
+    for (int x = begin; x < width; x++) {
+        int b = src[x * 3], g = src[x * 3 + 1], r = src[x * 3 + 2];
+        if (dither) {
+            int offset = this->threshold[y & 3][x & 3];
+            b = min(max(b + offset, 0), 255);
+            g = min(max(g + offset, 0), 255);
+            r = min(max(r + offset, 0), 255);
+        }
+        uint32_t color = this->bgrx[this->index(r, g, b)];
+        dest[x * 3] = color & 0xFF;
+        dest[x * 3 + 1] = (color >> 8) & 0xFF;
+        dest[x * 3 + 2] = (color >> 16) & 0xFF;
+    }
+}
+
+#if MASHIRO_REMAP_AVX2
+__attribute__((target("avx2")))
+int MashiroRemap::remapRowAVX2(const uint8_t * src, uint8_t * dest, int width, int y, bool dither) const noexcept {
+    // 8个像素在源图像中的字节偏移, 每次gather读出B, G, R和下一个像素的B
+    const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bins = _mm256_set1_epi32(0xF8);
+    // 把每条128位通道里的4个BGRx压缩为连续的12字节
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const int * lut = reinterpret_cast<const int *>(this->lut.data());
+    const int * palette = reinterpret_cast<const int *>(this->bgrx.data());
+    
+    // 抖动偏移按x循环, 每8个像素相同
+    __m256i threshold = zero;
+    if (dither) {
+        const int * row = this->threshold[y & 3];
+        threshold = _mm256_setr_epi32(row[0], row[1], row[2], row[3], row[0], row[1], row[2], row[3]);
+    }
+    
+    // 最后一次gather会多读一个字节, 所以留出一个像素
+    int x = 0;
+    for (; x + 9 <= width; x += 8) {
+        __m256i pixels = _mm256_i32gather_epi32(reinterpret_cast<const int *>(src + x * 3), offsets, 1);
+        __m256i b = _mm256_and_si256(pixels, byte);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte);
+        if (dither) {
+            b = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(b, threshold), zero), byte);
+            g = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(g, threshold), zero), byte);
+            r = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(r, threshold), zero), byte);
+        }
+        __m256i key = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(r, bins), 7),
+                                                      _mm256_slli_epi32(_mm256_and_si256(g, bins), 2)),
+                                      _mm256_srli_epi32(b, 3));
+        __m256i index = _mm256_and_si256(_mm256_i32gather_epi32(lut, key, 1), byte);
+        __m256i colors = _mm256_shuffle_epi8(_mm256_i32gather_epi32(palette, index, 4), pack);
+        
+        // 恰好写24字节, 原地映射时不会覆盖还没读的像素
+        uint8_t * out = dest + x * 3;
+        __m128i low = _mm256_castsi256_si128(colors);
+        __m128i high = _mm256_extracti128_si256(colors, 1);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), low);
+        uint32_t word = static_cast<uint32_t>(_mm_extract_epi32(low, 2));
+        memcpy(out + 8, &word, 4);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 12), high);
+        word = static_cast<uint32_t>(_mm_extract_epi32(high, 2));
+        memcpy(out + 20, &word, 4);
+    }
+    return x;
+}
+#else
+int MashiroRemap::remapRowAVX2(const uint8_t * src, uint8_t * dest, int width, int y, bool dither) const noexcept {
+    return 0;
+}
+#endif
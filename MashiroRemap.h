@@ -0,0 +1,83 @@
+//
+//  MashiroRemap.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_REMAP_H
+#define MASHIRO_REMAP_H
+
+#include <cstdint>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 把图像映射到调色板上(posterize / quantize)
+ *
+ *  @discussion 预先计算每个RGB量化格(每分量5位, 共32768格)最近的调色板颜色,
+ *              映射时每个像素只需要查两次表. 支持AVX2的CPU上使用gather指令,
+ *              可选4x4有序抖动, 按行多线程处理
+ */
+class MashiroRemap {
+public:
+    /**
+     *  @brief 为调色板建立查找表
+     *
+     *  @param palette 调色板, 即mashiro::color得到的RGB颜色, 最多256种
+     */
+    MashiroRemap(const Cluster& palette) noexcept;
+    
+    /**
+     *  @brief 映射一张BGR图像
+     *
+     *  @param src     源图片
+     *  @param dest    映射后的图片, 可以与源图片相同
+     *  @param dither  是否使用有序抖动
+     *  @param threads 线程数, 0表示使用全部核心
+     */
+    void remap(cv::Mat& src, cv::Mat& dest, bool dither = false, std::uint32_t threads = 0) const noexcept;
+    
+    /**
+     *  @brief 映射一块BGR排列的像素
+     *
+     *  @param srcStride  源图像每行的字节数
+     *  @param destStride 目标图像每行的字节数
+     */
+    void remap(const std::uint8_t * src, std::size_t srcStride, std::uint8_t * dest, std::size_t destStride, int width, int height, bool dither = false, std::uint32_t threads = 0) const noexcept;
+    
+    /**
+     *  @brief 一个颜色在调色板中对应的位置
+     */
+    std::uint8_t index(std::uint8_t r, std::uint8_t g, std::uint8_t b) const noexcept {
+        return this->lut[(r >> 3) << 10 | (g >> 3) << 5 | (b >> 3)];
+    }
+private:
+    /**
+     *  @brief 量化格到调色板位置的查找表, 末尾多留3个字节以便按32位gather
+     */
+    std::vector<std::uint8_t> lut;
+    
+    /**
+     *  @brief 调色板, 每种颜色以B, G, R, 0排列为32位
+     */
+    std::vector<std::uint32_t> bgrx;
+    
+    /**
+     *  @brief 有序抖动的偏移, 与调色板颜色之间的距离成比例
+     */
+    int threshold[4][4];
+    
+    /**
+     *  @brief 映射一行, 标量版本
+     */
+    void remapRow(const std::uint8_t * src, std::uint8_t * dest, int begin, int width, int y, bool dither) const noexcept;
+    
+    /**
+     *  @brief 映射一行, AVX2版本, 返回处理到的位置
+     */
+    int remapRowAVX2(const std::uint8_t * src, std::uint8_t * dest, int width, int y, bool dither) const noexcept;
+};
+
+#endif /* MASHIRO_REMAP_H */
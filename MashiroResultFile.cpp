@@ -0,0 +1,211 @@
+//
+//  MashiroResultFile.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroResultFile.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr char resultMagic[8] = { 'M', 'S', 'H', 'R', 'R', 'S', 'L', 'T' };
+static constexpr uint32_t resultVersion = 1;
+
+/**
+ *  @brief 向上对齐到64字节, 每一列从新的cache line开始
+ */
+static uint64_t align64(uint64_t offset) noexcept {
+    return (offset + 63) & ~uint64_t(63);
+}
+
+/**
+ *  @brief 从offset开始的count个unit字节的列是否完全在size字节的文件内, 乘法溢出也视为越界
+ */
+static bool inside(uint64_t offset, uint64_t count, uint64_t unit, uint64_t size) noexcept {
+    if (offset > size) return false;
+    return count <= (size - offset) / unit;
+}
+
+/**
+ *  @brief 检查文件头中的各列都在文件之内, 且列与列之间不重叠
+ */
+static bool validLayout(const MashiroResultHeader * h, uint64_t length) noexcept {
+    if (memcmp(h->magic, resultMagic, sizeof(resultMagic)) != 0 || h->version != resultVersion || h->size != length || h->capacity == 0) return false;
+    if (h->count > length / sizeof(uint32_t)) return false;
+    uint64_t colors = h->count * h->capacity;
+    if (colors / h->capacity != h->count) return false;
+    return h->idsOffset >= sizeof(MashiroResultHeader) && inside(h->idsOffset, h->count, sizeof(uint32_t), h->countsOffset) &&
+           inside(h->countsOffset, h->count, sizeof(uint32_t), h->centersOffset) &&
+           inside(h->centersOffset, colors, 3 * sizeof(float), h->weightsOffset) &&
+           inside(h->weightsOffset, colors, sizeof(float), h->namesOffset) &&
+           inside(h->namesOffset, h->count + 1, sizeof(uint64_t), length);
+}
+
+MashiroResultWriter::MashiroResultWriter(const string& path, const vector<string>& names, uint32_t capacity) noexcept : mapping(nullptr), length(0), header(nullptr) {
+    // 计算各列的位置
+    MashiroResultHeader layout;
+    memset(&layout, 0, sizeof(layout));
+    memcpy(layout.magic, resultMagic, sizeof(resultMagic));
+    layout.version = resultVersion;
+    layout.capacity = max(capacity, 1u);
+    layout.count = names.size();
+    layout.idsOffset = align64(sizeof(layout));
+    layout.countsOffset = align64(layout.idsOffset + layout.count * sizeof(uint32_t));
+    layout.centersOffset = align64(layout.countsOffset + layout.count * sizeof(uint32_t));
+    layout.weightsOffset = align64(layout.centersOffset + layout.count * layout.capacity * 3 * sizeof(float));
+    layout.namesOffset = align64(layout.weightsOffset + layout.count * layout.capacity * sizeof(float));
+    uint64_t characters = 0;
+    for (const auto& name : names) characters += name.size() + 1;
+    layout.size = layout.namesOffset + (layout.count + 1) * sizeof(uint64_t) + characters;
+    
+    // 预先分配整个文件, 未写入的部分为0
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (ftruncate(fd, layout.size) != 0) {
+        ::close(fd);
+        return;
+    }
+    void * mapped = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return;
+    this->mapping = mapped;
+    this->length = layout.size;
+    
+    uint8_t * base = static_cast<uint8_t *>(mapped);
+    uint32_t * ids = reinterpret_cast<uint32_t *>(base + layout.idsOffset);
+    uint64_t * nameOffsets = reinterpret_cast<uint64_t *>(base + layout.namesOffset);
+    char * characterData = reinterpret_cast<char *>(nameOffsets + layout.count + 1);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        ids[i] = static_cast<uint32_t>(i);
+        nameOffsets[i] = offset;
+        memcpy(characterData + offset, names[i].c_str(), names[i].size() + 1);
+        offset += names[i].size() + 1;
+    }
+    nameOffsets[names.size()] = offset;
+    
+    memcpy(base, &layout, sizeof(layout));
+    this->header = static_cast<MashiroResultHeader *>(mapped);
+}
+
+MashiroResultWriter::MashiroResultWriter(const string& path) noexcept : mapping(nullptr), length(0), header(nullptr) {
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MashiroResultHeader)) {
+        ::close(fd);
+        return;
+    }
+    void * mapped = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return;
+    this->mapping = mapped;
+    this->length = info.st_size;
+    
+    MashiroResultHeader * h = static_cast<MashiroResultHeader *>(mapped);
+    if (!validLayout(h, this->length)) return;
+    this->header = h;
+}
+
+MashiroResultWriter::~MashiroResultWriter() noexcept {
+    this->close();
+}
+
+void MashiroResultWriter::set(size_t index, const Cluster& colors, const vector<uint32_t>& weights) noexcept {
+    if (!this->header || index >= this->header->count) return;
+    uint8_t * base = static_cast<uint8_t *>(this->mapping);
+    uint32_t capacity = this->header->capacity;
+    uint32_t k = static_cast<uint32_t>(min<size_t>(colors.size(), capacity));
+    float * centers = reinterpret_cast<float *>(base + this->header->centersOffset) + index * capacity * 3;
+    float * proportions = reinterpret_cast<float *>(base + this->header->weightsOffset) + index * capacity;
+    
+    double total = 0;
+    for (uint32_t i = 0; i < k; i++) total += i < weights.size() ? weights[i] : 0;
+    for (uint32_t i = 0; i < k; i++) {
+        for (int c = 0; c < 3; c++) centers[i * 3 + c] = static_cast<float>(colors[i][c]);
+        proportions[i] = total > 0 && i < weights.size() ? static_cast<float>(weights[i] / total) : 0;
+    }
+    
+    // 最后写入颜色种数
+    reinterpret_cast<uint32_t *>(base + this->header->countsOffset)[index] = k;
+}
+
+bool MashiroResultWriter::close() noexcept {
+    if (!this->mapping) return false;
+    bool success = msync(this->mapping, this->length, MS_SYNC) == 0;
+    munmap(this->mapping, this->length);
+    this->mapping = nullptr;
+    this->header = nullptr;
+    return success;
+}
+
+MashiroResultFile::MashiroResultFile(const string& path) noexcept : mapping(nullptr), length(0), header(nullptr), characters(0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MashiroResultHeader)) {
+        close(fd);
+        return;
+    }
+    this->length = info.st_size;
+    void * mapped = mmap(NULL, this->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return;
+    this->mapping = mapped;
+    
+    // 检查文件头, 不认识或者各列越界的文件不使用
+    const MashiroResultHeader * h = static_cast<const MashiroResultHeader *>(mapped);
+    if (!validLayout(h, this->length)) return;
+    const uint8_t * base = static_cast<const uint8_t *>(mapped);
+    
+    // 字符区从偏移表之后到文件末尾, 所有路径都在其中, 且以'\0'结尾
+    const uint64_t * offsets = reinterpret_cast<const uint64_t *>(base + h->namesOffset);
+    uint64_t characters = this->length - (h->namesOffset + (h->count + 1) * sizeof(uint64_t));
+    if (offsets[h->count] != characters || (characters > 0 && base[this->length - 1] != '\0')) return;
+    this->characters = characters;
+    this->ids = reinterpret_cast<const uint32_t *>(base + h->idsOffset);
+    this->counts = reinterpret_cast<const uint32_t *>(base + h->countsOffset);
+    this->centerData = reinterpret_cast<const float *>(base + h->centersOffset);
+    this->weightData = reinterpret_cast<const float *>(base + h->weightsOffset);
+    this->nameOffsets = reinterpret_cast<const uint64_t *>(base + h->namesOffset);
+    this->header = h;
+}
+
+MashiroResultFile::~MashiroResultFile() noexcept {
+    if (this->mapping) munmap(this->mapping, this->length);
+}
+
+const char * MashiroResultFile::name(size_t i) const noexcept {
+    if (!this->header || i >= this->header->count || this->nameOffsets[i] >= this->characters) return "";
+    return reinterpret_cast<const char *>(this->nameOffsets + this->header->count + 1) + this->nameOffsets[i];
+}
+
+void MashiroResultFile::get(size_t i, Cluster& colors, vector<uint32_t>& weights) const noexcept {
+    colors.clear();
+    weights.clear();
+    if (!this->header || i >= this->header->count) return;
+    uint32_t k = min(this->counts[i], this->header->capacity);
+    const float * center = this->centers(i);
+    const float * proportion = this->weights(i);
+    for (uint32_t c = 0; c < k; c++) {
+        colors.emplace_back(center[c * 3], center[c * 3 + 1], center[c * 3 + 2]);
+        weights.emplace_back(static_cast<uint32_t>(proportion[c] * 1000000.0f + 0.5f));
+    }
+}
+
+bool MashiroResultFile::recognize(const string& path) noexcept {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char magic[8];
+    bool recognized = read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, resultMagic, sizeof(resultMagic)) == 0;
+    close(fd);
+    return recognized;
+}
@@ -0,0 +1,167 @@
+//
+//  MashiroResultFile.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_RESULT_FILE_H
+#define MASHIRO_RESULT_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mashiro.h"
+
+/**
+ *  @brief 结果文件头, 之后的各列按64字节对齐
+ *
+ *  @discussion 按列存放, 第i张图的数据在每一列的第i个位置:
+ *              ids      uint32[count]                 图片编号, 即在清单中的行号
+ *              counts   uint32[count]                 颜色种数, 0表示没有结果
+ *              centers  float[count][capacity][3]     颜色, 分量顺序与Cluster相同
+ *              weights  float[count][capacity]        每种颜色所占的比例, 和为1
+ *              names    uint64[count + 1]             路径在字符区中的偏移, 之后为以'\0'结尾的路径
+ */
+struct MashiroResultHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t capacity;
+    std::uint64_t count;
+    std::uint64_t idsOffset;
+    std::uint64_t countsOffset;
+    std::uint64_t centersOffset;
+    std::uint64_t weightsOffset;
+    std::uint64_t namesOffset;
+    std::uint64_t size;
+};
+
+/**
+ *  @brief 创建结果文件, 并行地填入各张图的结果
+ *
+ *  @discussion 创建时按图片数预先分配整个文件并映射到内存, 每张图的位置固定,
+ *              不同的图可以由不同的线程同时写入, 不需要加锁
+ */
+class MashiroResultWriter {
+public:
+    /**
+     *  @param path     输出文件
+     *  @param names    每张图的路径, 决定图片的个数
+     *  @param capacity 每张图最多几种颜色
+     */
+    MashiroResultWriter(const std::string& path, const std::vector<std::string>& names, std::uint32_t capacity) noexcept;
+    
+    /**
+     *  @brief 打开一个已经创建好的结果文件继续写入, 供多个进程共同写入同一个文件
+     */
+    MashiroResultWriter(const std::string& path) noexcept;
+    ~MashiroResultWriter() noexcept;
+    
+    MashiroResultWriter(const MashiroResultWriter&) = delete;
+    MashiroResultWriter& operator=(const MashiroResultWriter&) = delete;
+    
+    /**
+     *  @brief 文件是否创建成功
+     */
+    bool valid() const noexcept { return this->header != nullptr; }
+    
+    /**
+     *  @brief 有多少张图
+     */
+    std::uint64_t size() const noexcept { return this->header ? this->header->count : 0; }
+    
+    /**
+     *  @brief 写入第index张图的结果, 超出capacity的颜色被忽略
+     *
+     *  @param index   图片在清单中的位置
+     *  @param colors  主要颜色
+     *  @param weights 每种颜色包含的像素个数, 写入时换算为比例
+     */
+    void set(std::size_t index, const Cluster& colors, const std::vector<std::uint32_t>& weights) noexcept;
+    
+    /**
+     *  @brief 写回磁盘并解除映射
+     *
+     *  @return 是否成功
+     */
+    bool close() noexcept;
+private:
+    void * mapping;
+    std::size_t length;
+    MashiroResultHeader * header;
+};
+
+/**
+ *  @brief 内存映射的结果文件, 不需要解析即可随机访问
+ */
+class MashiroResultFile {
+public:
+    MashiroResultFile(const std::string& path) noexcept;
+    ~MashiroResultFile() noexcept;
+    
+    MashiroResultFile(const MashiroResultFile&) = delete;
+    MashiroResultFile& operator=(const MashiroResultFile&) = delete;
+    
+    /**
+     *  @brief 文件是否成功映射
+     */
+    bool valid() const noexcept { return this->header != nullptr; }
+    
+    /**
+     *  @brief 有多少张图
+     */
+    std::uint64_t size() const noexcept { return this->header ? this->header->count : 0; }
+    
+    /**
+     *  @brief 每张图最多几种颜色
+     */
+    std::uint32_t capacity() const noexcept { return this->header ? this->header->capacity : 0; }
+    
+    /**
+     *  @brief 第i张图的编号
+     */
+    std::uint32_t id(std::size_t i) const noexcept { return this->ids[i]; }
+    
+    /**
+     *  @brief 第i张图有几种颜色, 0表示没有结果, 文件损坏时可能超过capacity()
+     */
+    std::uint32_t count(std::size_t i) const noexcept { return this->counts[i]; }
+    
+    /**
+     *  @brief 第i张图的颜色, 共count(i)个, 每个3个分量
+     */
+    const float * centers(std::size_t i) const noexcept { return this->centerData + i * this->header->capacity * 3; }
+    
+    /**
+     *  @brief 第i张图每种颜色所占的比例
+     */
+    const float * weights(std::size_t i) const noexcept { return this->weightData + i * this->header->capacity; }
+    
+    /**
+     *  @brief 第i张图的路径
+     */
+    const char * name(std::size_t i) const noexcept;
+    
+    /**
+     *  @brief 取出第i张图的结果, 比例换算为以1000000为总和的整数权重
+     */
+    void get(std::size_t i, Cluster& colors, std::vector<std::uint32_t>& weights) const noexcept;
+    
+    /**
+     *  @brief 文件是否是结果文件
+     */
+    static bool recognize(const std::string& path) noexcept;
+private:
+    void * mapping;
+    std::size_t length;
+    const MashiroResultHeader * header;
+    const std::uint32_t * ids;
+    const std::uint32_t * counts;
+    const float * centerData;
+    const float * weightData;
+    const std::uint64_t * nameOffsets;
+    std::uint64_t characters;
+};
+
+#endif /* MASHIRO_RESULT_FILE_H */
@@ -0,0 +1,191 @@
+//
+//  MashiroShard.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroShard.h"
+#include "MashiroBatch.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr char shardMagic[8] = { 'M', 'S', 'H', 'R', 'S', 'H', 'R', 'D' };
+static constexpr uint32_t shardVersion = 2;
+
+constexpr uint32_t MashiroShard::maxAttempts;
+
+/**
+ *  @brief 区间状态的编码: 低32位为持有者的pid, 32-39位为领取次数, 40-47位为状态
+ */
+static uint64_t encode(MashiroShardState state, uint32_t attempts, pid_t owner) noexcept {
+    return uint64_t(state) << 40 | uint64_t(attempts & 0xFF) << 32 | uint32_t(owner);
+}
+
+static MashiroShardState stateOf(uint64_t word) noexcept {
+    return MashiroShardState((word >> 40) & 0xFF);
+}
+
+static uint32_t attemptsOf(uint64_t word) noexcept {
+    return (word >> 32) & 0xFF;
+}
+
+/**
+ *  @brief 对控制文件的一段加锁或解锁
+ *
+ *  @param type F_WRLCK或F_UNLCK
+ *  @param wait 是否等到能加锁为止
+ */
+static bool lockRegion(int fd, off_t offset, off_t length, short type, bool wait) noexcept {
+    struct flock lock = {};
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = offset;
+    lock.l_len = length;
+    int result;
+    do {
+        result = fcntl(fd, wait ? F_SETLKW : F_SETLK, &lock);
+    } while (result != 0 && errno == EINTR);
+    return result == 0;
+}
+
+/**
+ *  @brief 第range个区间的状态在控制文件中的位置, 也是它的记录锁
+ */
+static off_t rangeOffset(uint64_t range) noexcept {
+    return static_cast<off_t>(sizeof(MashiroShardHeader) + range * sizeof(uint64_t));
+}
+
+MashiroShard::MashiroShard(const string& controlPath, const string& resultPath, const vector<string>& paths, uint32_t capacity, uint64_t rangeSize) noexcept : fd(-1), mapping(nullptr), length(0), header(nullptr), states(nullptr) {
+    rangeSize = max<uint64_t>(rangeSize, 1);
+    uint64_t ranges = (paths.size() + rangeSize - 1) / rangeSize;
+    size_t size = sizeof(MashiroShardHeader) + ranges * sizeof(uint64_t);
+    
+    // 初始化与检查都在文件头的记录锁之内进行. 初始化的进程崩溃时锁被释放, 下一个进程看到未就绪的文件头, 重新初始化
+    int fd = open(controlPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (!lockRegion(fd, 0, sizeof(MashiroShardHeader), F_WRLCK, true)) {
+        close(fd);
+        return;
+    }
+    MashiroShardHeader existing = {};
+    bool ready = pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) && existing.ready == 1;
+    if (!ready) {
+        this->writer.reset(new MashiroResultWriter(resultPath, paths, capacity));
+        if (!this->writer->valid() || ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0) {
+            close(fd);
+            return;
+        }
+    } else {
+        struct stat info;
+        if (memcmp(existing.magic, shardMagic, sizeof(shardMagic)) != 0 || existing.version != shardVersion || existing.count != paths.size() || existing.rangeSize != rangeSize || existing.manifest != MashiroBatch::fingerprint(paths) || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) != size) {
+            close(fd);
+            return;
+        }
+        this->writer.reset(new MashiroResultWriter(resultPath));
+        if (!this->writer->valid() || this->writer->size() != paths.size()) {
+            close(fd);
+            return;
+        }
+    }
+    void * mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    MashiroShardHeader * h = static_cast<MashiroShardHeader *>(mapped);
+    if (!ready) {
+        memcpy(h->magic, shardMagic, sizeof(shardMagic));
+        h->version = shardVersion;
+        h->count = paths.size();
+        h->rangeSize = rangeSize;
+        h->ranges = ranges;
+        h->manifest = MashiroBatch::fingerprint(paths);
+        h->next = 0;
+        __atomic_store_n(&h->ready, 1u, __ATOMIC_RELEASE);
+    }
+    lockRegion(fd, 0, sizeof(MashiroShardHeader), F_UNLCK, false);
+    
+    // 文件保持打开, 关闭任何一个描述符都会释放这个进程持有的所有记录锁
+    this->fd = fd;
+    this->mapping = mapped;
+    this->length = size;
+    this->states = reinterpret_cast<uint64_t *>(h + 1);
+    this->header = h;
+}
+
+MashiroShard::~MashiroShard() noexcept {
+    if (this->mapping) munmap(this->mapping, this->length);
+    if (this->fd >= 0) close(this->fd);
+}
+
+bool MashiroShard::take(uint64_t range, uint64_t expected, uint32_t attempts) noexcept {
+    // 先加锁再改状态, 别的进程不会在两步之间把它当作持有者已退出的区间
+    if (!lockRegion(this->fd, rangeOffset(range), sizeof(uint64_t), F_WRLCK, false)) return false;
+    uint64_t desired = encode(MashiroShardClaimed, attempts, getpid());
+    if (__atomic_compare_exchange_n(&this->states[range], &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return true;
+    lockRegion(this->fd, rangeOffset(range), sizeof(uint64_t), F_UNLCK, false);
+    return false;
+}
+
+bool MashiroShard::claim(size_t& begin, size_t& end) noexcept {
+    if (!this->header) return false;
+    uint64_t ranges = this->header->ranges;
+    uint64_t range = ranges;
+    
+    // 先按计数器顺序领取新的区间
+    while (1) {
+        uint64_t next = __atomic_fetch_add(&this->header->next, 1, __ATOMIC_ACQ_REL);
+        if (next >= ranges) break;
+        if (this->take(next, encode(MashiroShardPending, 0, 0), 1)) {
+            range = next;
+            break;
+        }
+    }
+    
+    // 计数器用完后, 接手持有者已经退出的区间, 以及领取前就退出而留下的未领取区间.
+    // 已领取的区间能加上锁, 说明持有者已经退出
+    for (uint64_t r = 0; range == ranges && r < ranges; r++) {
+        uint64_t word = __atomic_load_n(&this->states[r], __ATOMIC_ACQUIRE);
+        MashiroShardState state = stateOf(word);
+        if (state == MashiroShardPending) {
+            if (this->take(r, word, 1)) range = r;
+        } else if (state == MashiroShardClaimed && attemptsOf(word) < maxAttempts) {
+            if (this->take(r, word, attemptsOf(word) + 1)) range = r;
+        } else if (state == MashiroShardClaimed && lockRegion(this->fd, rangeOffset(r), sizeof(uint64_t), F_WRLCK, false)) {
+            __atomic_compare_exchange_n(&this->states[r], &word, encode(MashiroShardFailed, attemptsOf(word), 0), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            lockRegion(this->fd, rangeOffset(r), sizeof(uint64_t), F_UNLCK, false);
+        }
+    }
+    if (range == ranges) return false;
+    
+    begin = static_cast<size_t>(range * this->header->rangeSize);
+    end = static_cast<size_t>(min(this->header->count, (range + 1) * this->header->rangeSize));
+    return true;
+}
+
+void MashiroShard::finish(size_t begin) noexcept {
+    if (!this->header) return;
+    uint64_t range = begin / this->header->rangeSize;
+    if (range >= this->header->ranges) return;
+    uint64_t word = __atomic_load_n(&this->states[range], __ATOMIC_ACQUIRE);
+    __atomic_store_n(&this->states[range], encode(MashiroShardDone, attemptsOf(word), getpid()), __ATOMIC_RELEASE);
+    lockRegion(this->fd, rangeOffset(range), sizeof(uint64_t), F_UNLCK, false);
+}
+
+uint64_t MashiroShard::ranges(MashiroShardState state) const noexcept {
+    if (!this->header) return 0;
+    uint64_t count = 0;
+    for (uint64_t r = 0; r < this->header->ranges; r++) {
+        if (stateOf(__atomic_load_n(&this->states[r], __ATOMIC_ACQUIRE)) == state) count++;
+    }
+    return count;
+}
@@ -0,0 +1,117 @@
+//
+//  MashiroShard.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_SHARD_H
+#define MASHIRO_SHARD_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MashiroResultFile.h"
+
+/**
+ *  @brief 控制文件头, 之后是每个区间一个64位的状态
+ */
+struct MashiroShardHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t ready;
+    std::uint64_t count;
+    std::uint64_t rangeSize;
+    std::uint64_t ranges;
+    std::uint64_t manifest;
+    std::uint64_t next;
+};
+
+/**
+ *  @brief 区间的状态
+ */
+enum MashiroShardState : std::uint32_t {
+    MashiroShardPending = 0,
+    MashiroShardClaimed,
+    MashiroShardDone,
+    
+    /**
+     *  @brief 持有它的进程多次崩溃, 不再重试
+     */
+    MashiroShardFailed
+};
+
+/**
+ *  @brief 多个进程共同处理一个清单, 结果写入同一个结果文件
+ *
+ *  @discussion 清单按rangeSize张图分成若干区间. 所有进程映射同一个控制文件,
+ *              用其中的原子计数器领取区间. 持有者在控制文件中这个区间的状态字节上加fcntl记录锁,
+ *              进程退出时锁由内核释放, 所以能加上锁的已领取区间的持有者一定已经不存在,
+ *              可以被重新领取, 与pid是否被复用无关. 某个进程崩溃后, 重新启动任意一个进程就能完成剩下的工作.
+ *              控制文件头同样由记录锁保护, 创建者在初始化途中崩溃时, 下一个进程重新初始化.
+ *              每张图在结果文件中的位置是固定的, 重做一个区间只会覆盖同样的位置.
+ *              同一个区间的持有者崩溃maxAttempts次后放弃. 状态中的pid只用于查看
+ */
+class MashiroShard {
+public:
+    static constexpr std::uint32_t maxAttempts = 3;
+    
+    /**
+     *  @param controlPath 控制文件, 不存在或没有初始化完成时由取得锁的进程创建, 同时创建结果文件
+     *  @param resultPath  结果文件
+     *  @param paths       清单, 所有进程必须相同
+     *  @param capacity    每张图最多几种颜色
+     *  @param rangeSize   每个区间有多少张图
+     */
+    MashiroShard(const std::string& controlPath, const std::string& resultPath, const std::vector<std::string>& paths, std::uint32_t capacity, std::uint64_t rangeSize = 256) noexcept;
+    ~MashiroShard() noexcept;
+    
+    MashiroShard(const MashiroShard&) = delete;
+    MashiroShard& operator=(const MashiroShard&) = delete;
+    
+    /**
+     *  @brief 控制文件与结果文件是否都已就绪
+     */
+    bool valid() const noexcept { return this->header != nullptr && this->writer && this->writer->valid(); }
+    
+    /**
+     *  @brief 领取一个区间
+     *
+     *  @param begin 输出, 区间的第一张图
+     *  @param end   输出, 区间最后一张图之后的位置
+     *
+     *  @return 是否领到, 没有可做的区间时返回false. 同一个进程应先finish()再领取下一个区间
+     */
+    bool claim(std::size_t& begin, std::size_t& end) noexcept;
+    
+    /**
+     *  @brief 完成begin所在的区间
+     */
+    void finish(std::size_t begin) noexcept;
+    
+    /**
+     *  @brief 处于某个状态的区间个数
+     */
+    std::uint64_t ranges(MashiroShardState state) const noexcept;
+    
+    /**
+     *  @brief 结果文件, 各进程写入自己领取的区间
+     */
+    MashiroResultWriter& results() noexcept { return *this->writer; }
+private:
+    int fd;
+    void * mapping;
+    std::size_t length;
+    MashiroShardHeader * header;
+    std::uint64_t * states;
+    std::unique_ptr<MashiroResultWriter> writer;
+    
+    /**
+     *  @brief 尝试把第range个区间从expected改为由当前进程持有, 成功时持有它的记录锁
+     */
+    bool take(std::uint64_t range, std::uint64_t expected, std::uint32_t attempts) noexcept;
+};
+
+#endif /* MASHIRO_SHARD_H */
@@ -0,0 +1,181 @@
+//
+//  MashiroStream.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroStream.h"
+#include "MashiroHistogram.h"
+#include "MashiroPerf.h"
+#include "MashiroTrace.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifdef MASHIRO_STREAM
+#include <csetjmp>
+#include <jpeglib.h>
+#include <png.h>
+#endif
+
+using namespace std;
+
+#ifdef MASHIRO_STREAM
+
+/**
+ *  @brief libjpeg出错时跳回调用处, 而不是退出进程
+ */
+struct MashiroJpegError {
+    struct jpeg_error_mgr manager;
+    jmp_buf jump;
+};
+
+static void jpegExit(j_common_ptr info) {
+    longjmp(reinterpret_cast<MashiroJpegError *>(info->err)->jump, 1);
+}
+
+static void jpegMessage(j_common_ptr info) {
+}
+
+/**
+ *  @brief 逐行解码JPEG
+ *
+ *  @discussion 出错时从libjpeg中longjmp回来, 所以行缓冲与缩小器由调用者持有,
+ *              这里setjmp之后不构造任何需要析构的对象
+ */
+static bool streamJpeg(FILE * file, int width, int interpolation, int convertColor, vector<uint8_t>& row, MashiroDownsampler& downsampler) noexcept {
+    struct jpeg_decompress_struct info;
+    MashiroJpegError error;
+    
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpegExit;
+    error.manager.output_message = jpegMessage;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    if (info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    
+    // 在DCT阶段缩小, 缩小后仍不小于目标宽度
+    info.scale_num = 1;
+    info.scale_denom = 1;
+    if (width > 0) {
+        for (unsigned denom = 8; denom > 1; denom >>= 1) {
+            if (info.image_width / denom >= unsigned(width)) {
+                info.scale_denom = denom;
+                break;
+            }
+        }
+    }
+#ifdef JCS_EXTENSIONS
+    info.out_color_space = JCS_EXT_BGR;
+#else
+    info.out_color_space = JCS_RGB;
+#endif
+    jpeg_start_decompress(&info);
+    
+    int cols = static_cast<int>(info.output_width);
+    int rows = static_cast<int>(info.output_height);
+    row.resize(size_t(cols) * 3);
+    downsampler.reset(cols, rows, width, interpolation, convertColor);
+    JSAMPROW pointer = row.data();
+    for (int y = 0; y < rows; y++) {
+        jpeg_read_scanlines(&info, &pointer, 1);
+        if (!downsampler.wants(y)) continue;
+#ifndef JCS_EXTENSIONS
+        for (int x = 0; x < cols; x++) swap(row[x * 3], row[x * 3 + 2]);
+#endif
+        downsampler.feed(y, row.data());
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+/**
+ *  @brief 逐行解码PNG, 与streamJpeg一样由调用者持有缓冲区
+ */
+static bool streamPng(FILE * file, int width, int interpolation, int convertColor, vector<uint8_t>& row, MashiroDownsampler& downsampler) noexcept {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png) return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+        return false;
+    }
+    png_init_io(png, file);
+    png_read_info(png, info);
+    
+    // 交错的PNG需要整张图才能逐行输出
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return false;
+    }
+    
+    // 统一转为8位BGR
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    png_set_gray_to_rgb(png);
+    png_set_bgr(png);
+    png_read_update_info(png, info);
+    
+    int cols = static_cast<int>(png_get_image_width(png, info));
+    int rows = static_cast<int>(png_get_image_height(png, info));
+    if (png_get_rowbytes(png, info) != size_t(cols) * 3) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return false;
+    }
+    row.resize(size_t(cols) * 3);
+    downsampler.reset(cols, rows, width, interpolation, convertColor);
+    for (int y = 0; y < rows; y++) {
+        png_read_row(png, row.data(), NULL);
+        if (downsampler.wants(y)) downsampler.feed(y, row.data());
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    return true;
+}
+
+#endif
+
+bool MashiroStream::supported() noexcept {
+#ifdef MASHIRO_STREAM
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool MashiroStream::pixels(const string& path, int width, int interpolation, int convertColor, MashiroHistogram& histogram) noexcept {
+#ifdef MASHIRO_STREAM
+    // 解码与统计交织在一起, 都计入解码阶段
+    MashiroPerfScope scope(MashiroPerfDecode);
+    MashiroTraceScope span("decode");
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    
+    // 按文件头判断格式
+    uint8_t magic[8] = {};
+    size_t length = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+    bool success = false;
+    vector<uint8_t> row;
+    MashiroDownsampler downsampler(histogram, 1, 1, width, interpolation, convertColor);
+    if (length >= 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) {
+        success = streamJpeg(file, width, interpolation, convertColor, row, downsampler);
+    } else if (length == 8 && png_sig_cmp(magic, 0, 8) == 0) {
+        success = streamPng(file, width, interpolation, convertColor, row, downsampler);
+    }
+    fclose(file);
+    return success;
+#else
+    return false;
+#endif
+}
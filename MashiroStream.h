@@ -0,0 +1,44 @@
+//
+//  MashiroStream.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_STREAM_H
+#define MASHIRO_STREAM_H
+
+#include <string>
+#include "mashiro.h"
+
+/**
+ *  @brief 逐行解码图片文件, 直接缩小并统计直方图, 不在内存中保留整张图
+ *
+ *  @discussion JPEG用libjpeg按扫描行解码, 并在DCT阶段先缩小到不小于目标宽度的1/2, 1/4或1/8;
+ *              PNG用libpng逐行读取. 每一行解码后立即送入MashiroDownsampler,
+ *              峰值内存只与图像宽度有关, 与高度无关. 需要编译时定义MASHIRO_STREAM
+ */
+class MashiroStream {
+public:
+    /**
+     *  @brief 编译时是否启用了逐行解码
+     */
+    static bool supported() noexcept;
+    
+    /**
+     *  @brief 逐行解码path, 缩小并计入直方图, 与mashiro::pixels的结果相近
+     *
+     *  @param path          图片文件
+     *  @param width         缩小后的宽度
+     *  @param interpolation cv::INTER_AREA或cv::INTER_NEAREST
+     *  @param convertColor  颜色空间转换, -1表示不转换
+     *  @param histogram     输出的直方图
+     *
+     *  @return 是否成功. 不支持的格式(如CMYK的JPEG, 交错的PNG)在计入任何像素之前返回false,
+     *          调用者应改用cv::imread. 文件中途损坏时直方图中可能已经计入了一部分像素
+     */
+    static bool pixels(const std::string& path, int width, int interpolation, int convertColor, MashiroHistogram& histogram) noexcept;
+};
+
+#endif /* MASHIRO_STREAM_H */
@@ -0,0 +1,145 @@
+//
+//  MashiroTrace.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "MashiroTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t MashiroTrace::capacity;
+atomic<bool> MashiroTrace::flag(false);
+
+/**
+ *  @brief 一个线程的环形缓冲区
+ */
+struct MashiroTraceBuffer {
+    uint32_t lane;
+    atomic<uint64_t> written;
+    unique_ptr<MashiroTraceEvent[]> events;
+};
+
+/**
+ *  @brief 所有缓冲区与空闲的缓冲区
+ *
+ *  @discussion 不释放, 进程退出时线程局部变量与静态变量的析构顺序不影响输出
+ */
+struct MashiroTraceRegistry {
+    mutex lock;
+    vector<unique_ptr<MashiroTraceBuffer>> buffers;
+    vector<MashiroTraceBuffer *> idle;
+};
+
+static MashiroTraceRegistry& registry() noexcept {
+    static MashiroTraceRegistry * instance = new MashiroTraceRegistry();
+    return *instance;
+}
+
+/**
+ *  @brief 线程使用的缓冲区, 线程结束时归还
+ */
+class MashiroTraceThread {
+public:
+    MashiroTraceBuffer * buffer = nullptr;
+    
+    ~MashiroTraceThread() noexcept {
+        if (!this->buffer) return;
+        MashiroTraceRegistry& shared = registry();
+        lock_guard<mutex> guard(shared.lock);
+        shared.idle.emplace_back(this->buffer);
+    }
+};
+
+static MashiroTraceBuffer& current() noexcept {
+    thread_local MashiroTraceThread instance;
+    if (!instance.buffer) {
+        // 优先使用序号最小的空闲缓冲区, 每次启动的工作线程尽量落在同样的行上
+        MashiroTraceRegistry& shared = registry();
+        lock_guard<mutex> guard(shared.lock);
+        if (shared.idle.empty()) {
+            MashiroTraceBuffer * buffer = new MashiroTraceBuffer();
+            buffer->lane = static_cast<uint32_t>(shared.buffers.size());
+            buffer->written.store(0, memory_order_relaxed);
+            buffer->events.reset(new MashiroTraceEvent[MashiroTrace::capacity]);
+            shared.buffers.emplace_back(buffer);
+            instance.buffer = buffer;
+        } else {
+            auto lowest = min_element(shared.idle.begin(), shared.idle.end(), [](const MashiroTraceBuffer * a, const MashiroTraceBuffer * b) { return a->lane < b->lane; });
+            instance.buffer = *lowest;
+            shared.idle.erase(lowest);
+        }
+    }
+    return *instance.buffer;
+}
+
+void MashiroTrace::enable(bool on) noexcept {
+    MashiroTrace::flag.store(on, memory_order_relaxed);
+}
+
+uint64_t MashiroTrace::now() noexcept {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void MashiroTrace::record(const MashiroTraceEvent& event) noexcept {
+    // 只有所属线程写入, 写完再更新计数, 读取的一方看到计数时记录已经完整
+    MashiroTraceBuffer& buffer = current();
+    uint64_t written = buffer.written.load(memory_order_relaxed);
+    buffer.events[written % MashiroTrace::capacity] = event;
+    buffer.written.store(written + 1, memory_order_release);
+}
+
+void MashiroTrace::clear() noexcept {
+    MashiroTraceRegistry& shared = registry();
+    lock_guard<mutex> guard(shared.lock);
+    for (auto& buffer : shared.buffers) buffer->written.store(0, memory_order_relaxed);
+}
+
+bool MashiroTrace::write(const string& path) noexcept {
+    ofstream output(path, ios::trunc);
+    if (!output) return false;
+    
+    MashiroTraceRegistry& shared = registry();
+    lock_guard<mutex> guard(shared.lock);
+    
+    // 时间从最早的记录开始, 单位微秒
+    uint64_t origin = UINT64_MAX;
+    for (auto& buffer : shared.buffers) {
+        uint64_t written = buffer->written.load(memory_order_acquire);
+        for (uint64_t i = written > MashiroTrace::capacity ? written - MashiroTrace::capacity : 0; i < written; i++) {
+            origin = min(origin, buffer->events[i % MashiroTrace::capacity].start);
+        }
+    }
+    
+    int pid = static_cast<int>(getpid());
+    uint64_t dropped = 0;
+    output<<"{\"traceEvents\":[\n"<<fixed<<setprecision(3);
+    output<<"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":"<<pid<<",\"tid\":0,\"args\":{\"name\":\"mashiro\"}}";
+    for (auto& buffer : shared.buffers) {
+        uint64_t written = buffer->written.load(memory_order_acquire);
+        uint64_t begin = written > MashiroTrace::capacity ? written - MashiroTrace::capacity : 0;
+        dropped += begin;
+        if (written == 0) continue;
+        output<<",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"<<pid<<",\"tid\":"<<buffer->lane<<",\"args\":{\"name\":\"thread "<<buffer->lane<<"\"}}";
+        for (uint64_t i = begin; i < written; i++) {
+            const MashiroTraceEvent& event = buffer->events[i % MashiroTrace::capacity];
+            output<<",\n{\"name\":\""<<event.name<<"\",\"cat\":\"mashiro\",\"ph\":\"X\",\"pid\":"<<pid<<",\"tid\":"<<buffer->lane;
+            output<<",\"ts\":"<<(event.start - origin) / 1000.0<<",\"dur\":"<<(event.end - event.start) / 1000.0;
+            if (event.argument >= 0) output<<",\"args\":{\"index\":"<<event.argument<<'}';
+            output<<'}';
+        }
+    }
+    output<<"\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":"<<dropped<<"}}\n";
+    output.flush();
+    return output.good();
+}
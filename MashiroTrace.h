@@ -0,0 +1,111 @@
+//
+//  MashiroTrace.h
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#ifndef MASHIRO_TRACE_H
+#define MASHIRO_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ *  @brief 一段记录下来的时间
+ */
+struct MashiroTraceEvent {
+    /**
+     *  @brief 名字, 必须是字符串常量
+     */
+    const char * name;
+    
+    /**
+     *  @brief 开始与结束的时间, 单位纳秒
+     */
+    std::uint64_t start;
+    std::uint64_t end;
+    
+    /**
+     *  @brief 附带的序号, 如图片在列表中的位置, -1表示没有
+     */
+    std::int64_t argument;
+};
+
+/**
+ *  @brief 记录各阶段的时间线, 输出为Chrome trace event格式, 可以用Perfetto或chrome://tracing打开
+ *
+ *  @discussion 每个线程写自己的环形缓冲区, 记录时不加锁, 满了之后覆盖最早的记录.
+ *              缓冲区在线程第一次记录时才分配, 线程结束后留给之后的线程使用, 所以时间线上的一行
+ *              对应一个缓冲区而不是一个系统线程. 没有打开时每段只多一次原子读
+ */
+class MashiroTrace {
+public:
+    /**
+     *  @brief 每个线程最多保留的记录数
+     */
+    static constexpr std::size_t capacity = 1 << 16;
+    
+    /**
+     *  @brief 打开或关闭记录
+     */
+    static void enable(bool on) noexcept;
+    
+    /**
+     *  @brief 是否正在记录
+     */
+    static bool enabled() noexcept {
+        return MashiroTrace::flag.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     *  @brief 单调时钟, 单位纳秒
+     */
+    static std::uint64_t now() noexcept;
+    
+    /**
+     *  @brief 在当前线程的缓冲区中追加一段记录
+     */
+    static void record(const MashiroTraceEvent& event) noexcept;
+    
+    /**
+     *  @brief 清空所有线程的记录, 不能与记录同时进行
+     */
+    static void clear() noexcept;
+    
+    /**
+     *  @brief 把所有线程的记录写入文件, 应在记录的线程都结束工作之后调用
+     *
+     *  @return 是否写入成功
+     */
+    static bool write(const std::string& path) noexcept;
+private:
+    static std::atomic<bool> flag;
+};
+
+/**
+ *  @brief 记录一个作用域的开始与结束
+ */
+class MashiroTraceScope {
+public:
+    MashiroTraceScope(const char * _name, std::int64_t _argument = -1) noexcept : active(MashiroTrace::enabled()) {
+        if (this->active) this->event = { _name, MashiroTrace::now(), 0, _argument };
+    }
+    
+    ~MashiroTraceScope() noexcept {
+        if (!this->active) return;
+        this->event.end = MashiroTrace::now();
+        MashiroTrace::record(this->event);
+    }
+    
+    MashiroTraceScope(const MashiroTraceScope&) = delete;
+    MashiroTraceScope& operator=(const MashiroTraceScope&) = delete;
+private:
+    bool active;
+    MashiroTraceEvent event;
+};
+
+#endif /* MASHIRO_TRACE_H */
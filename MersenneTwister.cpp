@@ -25,16 +25,47 @@ uint32_t MersenneTwister::rand() {
     y ^= (y << 15) & 0xEFC60000;
     y ^= (y >> 18);
     
-    this->index = (this->index + 1) % 624;
+    if (++this->index == 624)
+        this->index = 0;
     
     return y;
 }
 
+void MersenneTwister::fill(uint32_t * buffer, size_t count) {
+    while (count > 0) {
+        if (this->index == 0)
+            this->reseed();
+        
+        // 一次取完当前状态里剩下的
+        size_t n = 624 - this->index;
+        if (n > count) n = count;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t y = this->state[this->index + i];
+            y ^= (y >> 11);
+            y ^= (y <<  7) & 0x9D2C5680;
+            y ^= (y << 15) & 0xEFC60000;
+            y ^= (y >> 18);
+            buffer[i] = y;
+        }
+        buffer += n;
+        count -= n;
+        this->index += n;
+        if (this->index == 624)
+            this->index = 0;
+    }
+}
+
 void MersenneTwister::reseed() {
-    for (size_t i = 0; i < 624; i++) {
-        uint32_t y = (this->state[i] & 0x80000000) + (this->state[(i + 1) % 624] & 0x7FFFFFFF);
-        this->state[i] = this->state[(i + 397) % 624] ^ (y >> 1);
-        if (y % 2 != 0)
-            this->state[i] ^= 0x9908B0DF;
+    // 拆成三段, 避免每一步取模
+    size_t i = 0;
+    for (; i < 624 - 397; i++) {
+        uint32_t y = (this->state[i] & 0x80000000) + (this->state[i + 1] & 0x7FFFFFFF);
+        this->state[i] = this->state[i + 397] ^ (y >> 1) ^ ((y & 1) ? 0x9908B0DF : 0);
+    }
+    for (; i < 623; i++) {
+        uint32_t y = (this->state[i] & 0x80000000) + (this->state[i + 1] & 0x7FFFFFFF);
+        this->state[i] = this->state[i + 397 - 624] ^ (y >> 1) ^ ((y & 1) ? 0x9908B0DF : 0);
     }
+    uint32_t y = (this->state[623] & 0x80000000) + (this->state[0] & 0x7FFFFFFF);
+    this->state[623] = this->state[396] ^ (y >> 1) ^ ((y & 1) ? 0x9908B0DF : 0);
 }
@@ -21,6 +21,7 @@ private:
 public:
     MersenneTwister(uint32_t seed);
     uint32_t rand();
+    void fill(uint32_t * buffer, size_t count);
 };
 
 #endif /* MersenneTwister_H */
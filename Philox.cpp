@@ -0,0 +1,151 @@
+//
+//  Philox.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include "Philox.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+Philox::Philox(uint64_t seed, uint64_t stream) {
+    this->key[0] = static_cast<uint32_t>(seed);
+    this->key[1] = static_cast<uint32_t>(seed >> 32);
+    this->stream = stream;
+    this->counter = 0;
+    this->index = 4;
+}
+
+void Philox::generate(uint64_t n, uint32_t output[4]) const {
+    uint32_t c0 = static_cast<uint32_t>(n), c1 = static_cast<uint32_t>(n >> 32);
+    uint32_t c2 = static_cast<uint32_t>(this->stream), c3 = static_cast<uint32_t>(this->stream >> 32);
+    uint32_t k0 = this->key[0], k1 = this->key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0;
+        uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * c2;
+        uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<uint32_t>(p1);
+        c3 = static_cast<uint32_t>(p0);
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+uint32_t Philox::rand() {
+    if (this->index == 4) {
+        this->generate(this->counter++, this->block);
+        this->index = 0;
+    }
+    return this->block[this->index++];
+}
+
+uint32_t Philox::uniform(uint32_t bound) {
+    // 乘法取高位, 避免取模
+    return static_cast<uint32_t>((static_cast<uint64_t>(this->rand()) * bound) >> 32);
+}
+
+double Philox::real() {
+    return this->rand() * (1.0 / 4294967296.0);
+}
+
+void Philox::fill(uint32_t * buffer, size_t count) {
+    // 先用完当前块里剩下的
+    while (count > 0 && this->index < 4) {
+        *buffer++ = this->block[this->index++];
+        count--;
+    }
+    
+#if defined(__SSE2__)
+    // 4个块为一组, 每个寄存器存放4个块的同一个分量
+    const __m128i m0 = _mm_set1_epi32(static_cast<int>(PHILOX_M0));
+    const __m128i m1 = _mm_set1_epi32(static_cast<int>(PHILOX_M1));
+    const __m128i lowMask = _mm_set_epi32(0, -1, 0, -1);
+    const __m128i s2 = _mm_set1_epi32(static_cast<int>(this->stream));
+    const __m128i s3 = _mm_set1_epi32(static_cast<int>(this->stream >> 32));
+    while (count >= 16) {
+        uint64_t n = this->counter;
+        __m128i c0 = _mm_set_epi32(static_cast<int>(n + 3), static_cast<int>(n + 2), static_cast<int>(n + 1), static_cast<int>(n));
+        __m128i c1 = _mm_set_epi32(static_cast<int>((n + 3) >> 32), static_cast<int>((n + 2) >> 32), static_cast<int>((n + 1) >> 32), static_cast<int>(n >> 32));
+        __m128i c2 = s2, c3 = s3;
+        uint32_t k0 = this->key[0], k1 = this->key[1];
+        for (int round = 0; round < 10; round++) {
+            // 32x32->64位乘法, 偶数与奇数位置分别计算
+            __m128i even0 = _mm_mul_epu32(c0, m0);
+            __m128i odd0 = _mm_mul_epu32(_mm_srli_epi64(c0, 32), m0);
+            __m128i even1 = _mm_mul_epu32(c2, m1);
+            __m128i odd1 = _mm_mul_epu32(_mm_srli_epi64(c2, 32), m1);
+            __m128i lo0 = _mm_or_si128(_mm_and_si128(even0, lowMask), _mm_slli_epi64(odd0, 32));
+            __m128i hi0 = _mm_or_si128(_mm_srli_epi64(even0, 32), _mm_andnot_si128(lowMask, odd0));
+            __m128i lo1 = _mm_or_si128(_mm_and_si128(even1, lowMask), _mm_slli_epi64(odd1, 32));
+            __m128i hi1 = _mm_or_si128(_mm_srli_epi64(even1, 32), _mm_andnot_si128(lowMask, odd1));
+            c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32(static_cast<int>(k0)));
+            c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32(static_cast<int>(k1)));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        
+        // 转置回每个块4个连续的输出
+        __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+        __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+        __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+        __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer + 4), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer + 8), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer + 12), _mm_unpackhi_epi64(t2, t3));
+        this->counter += 4;
+        buffer += 16;
+        count -= 16;
+    }
+#endif
+    
+    while (count >= 4) {
+        this->generate(this->counter++, buffer);
+        buffer += 4;
+        count -= 4;
+    }
+    while (count > 0) {
+        *buffer++ = this->rand();
+        count--;
+    }
+}
+
+void Philox::discard(uint64_t count) {
+    // 当前块剩下的数量
+    uint64_t left = 4 - this->index;
+    if (count < left) {
+        this->index += count;
+        return;
+    }
+    count -= left;
+    this->counter += count / 4;
+    this->index = 4;
+    if (count % 4) {
+        this->generate(this->counter++, this->block);
+        this->index = count % 4;
+    }
+}
+
+Philox Philox::split(uint64_t stream) const {
+    Philox other(0, stream);
+    memcpy(other.key, this->key, sizeof(this->key));
+    return other;
+}
@@ -6,31 +6,100 @@
 //  Copyright © 2016 BlueCocoa. All rights reserved.
 //
 
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include "mashiro.h"
+#include "MashiroAggregate.h"
+#include "MashiroBatch.h"
+#include "MashiroDaemon.h"
+#include "MashiroHistogram.h"
+#include "MashiroJson.h"
+#include "MashiroPerf.h"
+#include "MashiroTrace.h"
+#include "MashiroRemap.h"
+#include "MashiroResultFile.h"
+#include "MashiroShard.h"
+#include "MashiroStream.h"
 
 using namespace cv;
 using namespace std;
 
 char * imageFile = NULL;
 uint32_t color = 3;
+uint32_t autoColor = 0;
+int tileSize = 0;
+double epsilon = 0;
+uint32_t coresetSize = 0;
+uint32_t threads = 0;
+char * socketFile = NULL;
+char * manifestFile = NULL;
+char * remapFile = NULL;
+char * aggregateFile = NULL;
+char * perfFile = NULL;
+char * resultFile = NULL;
+char * shardFile = NULL;
+char * traceFile = NULL;
+bool dither = false;
+bool streamInput = false;
+bool pyramid = false;
+bool numa = false;
+MashiroDaemon * daemonInstance = NULL;
 
 static struct option long_options[] = {
     {"help", no_argument, 0, 'h'},
     {"image", required_argument, 0, 'i'},
     {"color", optional_argument, 0, 'c'},
+    {"auto", required_argument, 0, 'a'},
+    {"tile", required_argument, 0, 't'},
+    {"sample", required_argument, 0, 'e'},
+    {"full", required_argument, 0, 'f'},
+    {"threads", required_argument, 0, 'j'},
+    {"daemon", required_argument, 0, 'd'},
+    {"batch", required_argument, 0, 'b'},
+    {"quantize", required_argument, 0, 'q'},
+    {"dither", no_argument, 0, 'D'},
+    {"aggregate", required_argument, 0, 'g'},
+    {"perf", required_argument, 0, 'P'},
+    {"stream", no_argument, 0, 'S'},
+    {"pyramid", no_argument, 0, 'p'},
+    {"output", required_argument, 0, 'o'},
+    {"shard", required_argument, 0, 'x'},
+    {"numa", no_argument, 0, 'N'},
+    {"trace", required_argument, 0, 'T'},
     {0, 0, 0, 0}
 };
 
 void print_usage();
 int parse(int argc, const char * argv[]);
+void stop_daemon(int signal);
+void print_colors(const Cluster& colors);
 
 void print_usage() {
     printf("Usage:\n");
     printf("\t-i [image file] -c [number of color to cluster]\n");
+    printf("\t-a [max number of color] Choose the number of colors automatically\n");
+    printf("\t-t [tile size] Cluster tiles of the image in parallel, for very large images\n");
+    printf("\t-q [output image] Write the image remapped to its dominant colors, -D to dither\n");
+    printf("\t-b [manifest] Process every image listed in the manifest, one path per line\n");
+    printf("\t-o [result file] With -b, write all palettes into one memory-mappable binary file instead of text lines\n");
+    printf("\t-x [control file] With -b and -o, share the manifest with other mashiro processes through this control file\n");
+    printf("\t-g [aggregate file] With -b, accumulate all palettes into this file; alone, print the dominant colors of the aggregate\n");
+    printf("\t-p Cluster coarse-to-fine from a 32 px thumbnail up to the 200 px histogram, seeding each level with the previous one\n");
+    printf("\t-S Decode JPEG and PNG strip by strip into the histogram, memory does not grow with image height; not with -p\n");
+    printf("\t-e [error] Cluster a stratified random sample sized for this error on color proportions, e.g. 0.02\n");
+    printf("\t-f [coreset size] Cluster the full-resolution image through a weighted coreset of this size\n");
+    printf("\t-P [output file] Write hardware counters of each stage as JSON lines, per image and for the whole batch\n");
+    printf("\t-T [output file] Write a timeline of every stage on every thread as Chrome trace JSON, for Perfetto\n");
+    printf("\t-j [threads] Number of threads used by -t, -d and -b, defaults to all cores\n");
+    printf("\t-N With -b, pin threads to cores spread over NUMA nodes and keep each image on one node\n");
+    printf("\t-d [socket] Run as a daemon serving requests on the Unix domain socket\n");
     printf("\t-h Print this help\n");
 }
 
@@ -39,7 +108,7 @@ int parse(int argc, const char * argv[]) {
     int option_index = 0;
     
     while (1) {
-        c = getopt_long(argc, (char * const *)argv, "hs:i:c:", long_options, &option_index);
+        c = getopt_long(argc, (char * const *)argv, "hs:i:c:a:t:e:f:j:d:b:q:Dg:P:Spo:x:NT:", long_options, &option_index);
         if (c == -1)
             break;
         switch (c) {
@@ -56,6 +125,74 @@ int parse(int argc, const char * argv[]) {
                 color = abs(atoi(optarg));
                 break;
             }
+            case 'a': {
+                autoColor = abs(atoi(optarg));
+                break;
+            }
+            case 't': {
+                tileSize = abs(atoi(optarg));
+                break;
+            }
+            case 'e': {
+                epsilon = fabs(atof(optarg));
+                break;
+            }
+            case 'f': {
+                coresetSize = abs(atoi(optarg));
+                break;
+            }
+            case 'j': {
+                threads = abs(atoi(optarg));
+                break;
+            }
+            case 'd': {
+                socketFile = strdup(optarg);
+                break;
+            }
+            case 'b': {
+                manifestFile = strdup(optarg);
+                break;
+            }
+            case 'q': {
+                remapFile = strdup(optarg);
+                break;
+            }
+            case 'D': {
+                dither = true;
+                break;
+            }
+            case 'g': {
+                aggregateFile = strdup(optarg);
+                break;
+            }
+            case 'P': {
+                perfFile = strdup(optarg);
+                break;
+            }
+            case 'S': {
+                streamInput = true;
+                break;
+            }
+            case 'p': {
+                pyramid = true;
+                break;
+            }
+            case 'o': {
+                resultFile = strdup(optarg);
+                break;
+            }
+            case 'x': {
+                shardFile = strdup(optarg);
+                break;
+            }
+            case 'N': {
+                numa = true;
+                break;
+            }
+            case 'T': {
+                traceFile = strdup(optarg);
+                break;
+            }
             case '?':
                 print_usage();
                 return 0;
@@ -66,23 +203,213 @@ int parse(int argc, const char * argv[]) {
     return 1;
 }
 
+void print_colors(const Cluster& colors) {
+    for_each(colors.cbegin(), colors.cend(), [](const MashiroColor& color){
+        cout<<"("<<color[mashiro::toType(MashiroColorSpaceRGB::Red)]<<", "<<color[mashiro::toType(MashiroColorSpaceRGB::Green)]<<", "<<color[mashiro::toType(MashiroColorSpaceRGB::Blue)]<<")"<<endl;
+    });
+}
+
+void stop_daemon(int signal) {
+    if (daemonInstance) daemonInstance->stop();
+}
+
 int main(int argc, const char * argv[]) {
+    int status = 0;
     if (parse(argc, argv)) {
-        if (imageFile && strlen(imageFile) > 0) {
-            Mat image = imread(imageFile);
+        // 逐行解码时只有最后一层的直方图, 无法由粗到细聚类
+        if (streamInput && pyramid) {
+            cerr<<"-S cannot be combined with -p"<<endl;
+            print_usage();
+            return 1;
+        }
+        
+        // 每张图一行各阶段的计数, 批量模式最后再输出一行总计
+        ofstream perfOutput;
+        if (perfFile) {
+            perfOutput.open(perfFile, ios::trunc);
+            MashiroPerf::enable(true);
+        }
+        // 各线程的时间线在结束时一起写出
+        if (traceFile) MashiroTrace::enable(true);
+        
+        if (socketFile && strlen(socketFile) > 0) {
+            MashiroDaemon daemon(socketFile, threads);
+            daemonInstance = &daemon;
+            signal(SIGINT, stop_daemon);
+            signal(SIGTERM, stop_daemon);
+            if (daemon.run() != 0) {
+                perror("mashiro");
+                return 1;
+            }
+        } else if (manifestFile && strlen(manifestFile) > 0 && shardFile && resultFile) {
+            // 与其他进程一起处理同一个清单, 每次领取一个区间, 结果写入结果文件中预先分配的位置
+            vector<string> paths = MashiroBatch::manifest(manifestFile);
+            MashiroShard shard(shardFile, resultFile, paths, color);
+            if (!shard.valid()) {
+                cerr<<shardFile<<": cannot open the shard control file or "<<resultFile<<endl;
+                return 1;
+            }
+            mutex outputLock;
+            MashiroBatch batch(color, threads, -1, numa);
+            size_t begin, end;
+            while (shard.claim(begin, end)) {
+                vector<string> range(paths.begin() + begin, paths.begin() + end);
+                batch.run(range, [&](size_t index, const string& path, const Cluster& colors, const vector<uint32_t>& weights){
+                    if (colors.empty()) {
+                        lock_guard<mutex> lock(outputLock);
+                        cerr<<path<<": cannot read image"<<endl;
+                        return;
+                    }
+                    shard.results().set(begin + index, colors, weights);
+                });
+                shard.finish(begin);
+            }
+            uint64_t failed = shard.ranges(MashiroShardFailed);
+            uint64_t unfinished = shard.ranges(MashiroShardPending) + shard.ranges(MashiroShardClaimed);
+            cerr<<shard.ranges(MashiroShardDone)<<" ranges done, "<<unfinished<<" in progress, "<<failed<<" failed"<<endl;
+            if (failed > 0) status = 1;
+        } else if (manifestFile && strlen(manifestFile) > 0) {
+            // 每张图输出一行, 完成的顺序不固定
+            mutex outputLock;
+            MashiroBatch batch(color, threads, -1, numa);
+            
+            // 在已有的聚合上继续累加, 定期保存. 聚合记录了清单中已经加入的图, 中断后再次运行时跳过它们
+            vector<string> paths = MashiroBatch::manifest(manifestFile);
+            unique_ptr<MashiroAggregate> aggregate;
+            vector<size_t> pending;
+            if (aggregateFile) {
+                aggregate.reset(new MashiroAggregate());
+                aggregate->track(paths);
+                struct stat info;
+                if (stat(aggregateFile, &info) == 0 && !aggregate->load(aggregateFile)) {
+                    cerr<<aggregateFile<<": cannot read aggregate, or it was built from another manifest"<<endl;
+                    return 1;
+                }
+            }
+            for (size_t i = 0; i < paths.size(); i++) {
+                if (!aggregate || !aggregate->finished(i)) pending.emplace_back(i);
+            }
+            if (pending.size() < paths.size()) cerr<<"resuming: "<<paths.size() - pending.size()<<" images already in "<<aggregateFile<<endl;
+            
+            // 结果文件中每张图的位置按清单预先分配, 继续时沿用已有的结果文件
+            unique_ptr<MashiroResultWriter> writer;
+            if (resultFile) {
+                if (pending.size() < paths.size()) {
+                    writer.reset(new MashiroResultWriter(resultFile));
+                    if (writer->valid() && writer->size() != paths.size()) writer.reset();
+                } else {
+                    writer.reset(new MashiroResultWriter(resultFile, paths, color));
+                }
+                if (!writer || !writer->valid()) {
+                    cerr<<resultFile<<": cannot open the result file"<<endl;
+                    return 1;
+                }
+            }
+            vector<string> remaining;
+            for (size_t index : pending) remaining.emplace_back(paths[index]);
+            
+            size_t completed = 0;
+            MashiroPerfReport total;
+            bool available = perfFile && MashiroPerf::available();
+            batch.run(remaining, [&](size_t position, const string& path, const Cluster& colors, const vector<uint32_t>& weights){
+                size_t index = pending[position];
+                if (writer && !colors.empty()) writer->set(index, colors, weights);
+                MashiroPerfReport report;
+                if (perfFile) report = MashiroPerf::collect();
+                lock_guard<mutex> lock(outputLock);
+                
+                // 与保存互斥, 保存的直方图与完成标记一致. 无法读取的图也标记完成, 继续时不再重试
+                if (aggregate) {
+                    if (!colors.empty()) aggregate->add(colors, weights);
+                    aggregate->finish(index);
+                }
+                if (perfFile) {
+                    total += report;
+                    perfOutput<<"{\"image\":"<<MashiroJson::quote(path)<<",\"stages\":"<<MashiroPerf::json(report)<<"}\n";
+                }
+                if (colors.empty()) {
+                    cerr<<path<<": cannot read image"<<endl;
+                } else if (!writer) {
+                    cout<<MashiroBatch::format(path, colors, weights)<<'\n';
+                }
+                if (++completed % 4096 == 0 && aggregate) aggregate->save(aggregateFile);
+            });
+            if (perfFile) {
+                perfOutput<<"{\"images\":"<<completed<<",\"counters\":"<<(available ? "true" : "false")<<",\"stages\":"<<MashiroPerf::json(total)<<"}"<<endl;
+            }
+            if ((writer && !writer->close()) || (aggregate && !aggregate->save(aggregateFile))) {
+                perror("mashiro");
+                return 1;
+            }
+        } else if (imageFile && strlen(imageFile) > 0 && streamInput && !remapFile && tileSize == 0 && coresetSize == 0 && epsilon == 0) {
+            // 逐行解码, 不在内存中保留整张图. 不支持的格式退回到imread
+            MashiroHistogram histogram;
+            if (!MashiroStream::pixels(imageFile, 200, INTER_AREA, -1, histogram)) {
+                histogram.clear();
+                Mat image = imread(imageFile);
+                assert((image.rows * image.cols) != 0);
+                mashiro::pixels(image, 200, INTER_AREA, -1, histogram);
+            }
+            vector<MashiroColorWithCount> pixels;
+            histogram.colors(pixels);
+            print_colors(autoColor > 0 ? mashiro::kmeansAuto(pixels, autoColor) : mashiro::kmeans(pixels, color));
+            if (perfFile) {
+                perfOutput<<"{\"image\":"<<MashiroJson::quote(imageFile)<<",\"counters\":"<<(MashiroPerf::available() ? "true" : "false")<<",\"stages\":"<<MashiroPerf::json(MashiroPerf::collect())<<"}"<<endl;
+            }
+        } else if (imageFile && strlen(imageFile) > 0) {
+            Mat image;
+            {
+                MashiroPerfScope scope(MashiroPerfDecode);
+                MashiroTraceScope span("decode");
+                image = imread(imageFile);
+            }
             assert((image.rows * image.cols) != 0);
             
             mashiro shiro(image);
-            shiro.color(color, [](cv::Mat& image, Cluster colors){
-                for_each(colors.cbegin(), colors.cend(), [](const MashiroColor& color){
-                    cout<<"("<<std::get<mashiro::toType(MashiroColorSpaceRGB::Red)>(color)<<", "<<std::get<mashiro::toType(MashiroColorSpaceRGB::Green)>(color)<<", "<<std::get<mashiro::toType(MashiroColorSpaceRGB::Blue)>(color)<<")"<<endl;
-                });
-            });
+            auto callback = [](cv::Mat& image, Cluster colors){
+                print_colors(colors);
+                
+                // 用主要颜色重新绘制整张图
+                if (remapFile) {
+                    Mat posterized;
+                    MashiroRemap(colors).remap(image, posterized, dither, threads);
+                    imwrite(remapFile, posterized);
+                }
+            };
+            if (autoColor > 0) {
+                shiro.colorAuto(callback, autoColor);
+            } else if (tileSize > 0) {
+                shiro.colorTiled(color, callback, tileSize, threads);
+            } else if (coresetSize > 0) {
+                // 不缩小图像, 用coreset代替完整的直方图
+                callback(image, mashiro::kmeans(mashiro::coreset(mashiro::pixels(image), coresetSize), color));
+            } else if (epsilon > 0) {
+                shiro.colorSampled(color, callback, epsilon);
+            } else if (pyramid) {
+                shiro.colorPyramid(color, callback);
+            } else {
+                shiro.color(color, callback);
+            }
+            if (perfFile) {
+                perfOutput<<"{\"image\":"<<MashiroJson::quote(imageFile)<<",\"counters\":"<<(MashiroPerf::available() ? "true" : "false")<<",\"stages\":"<<MashiroPerf::json(MashiroPerf::collect())<<"}"<<endl;
+            }
+        } else if (aggregateFile && strlen(aggregateFile) > 0) {
+            MashiroAggregate aggregate;
+            if (!aggregate.load(aggregateFile)) {
+                cerr<<aggregateFile<<": cannot read aggregate"<<endl;
+                return 1;
+            }
+            print_colors(aggregate.cluster(color));
         } else {
             print_usage();
         }
+        
+        if (traceFile && !MashiroTrace::write(traceFile)) {
+            cerr<<traceFile<<": cannot write trace"<<endl;
+            status = 1;
+        }
     } else {
         print_usage();
     }
-    return 0;
+    return status;
 }
@@ -7,6 +7,11 @@
 //
 
 #include "mashiro.h"
+#include "MashiroHistogram.h"
+#include "MashiroPerf.h"
+#include "MashiroTrace.h"
+#include <array>
+#include <atomic>
 #include <opencv2/opencv.hpp>
 
 using namespace cv;
@@ -15,23 +20,91 @@ using namespace std;
 mashiro::mashiro(Mat& _image) noexcept : image(_image) { }
 
 void mashiro::color(std::uint32_t number, MashiroColorCallback callback, int convertColor) noexcept {
-    // 调整一下原始图像的大小
-    Mat smallerImage;
-    mashiro::resize(this->image, smallerImage, 200, 200, CV_INTER_LINEAR);
+    // 把原始图像缩小到200像素宽, 同时获取每种颜色及其出现的次数
+    vector<MashiroColorWithCount> pixels = mashiro::pixels(this->image, 200, INTER_AREA, convertColor);
     
-    if (convertColor != -1) cvtColor(smallerImage, smallerImage, convertColor);
+    // 使用kmeans聚类
+    Cluster clusters = this->kmeans(pixels, number);
+    
+    // 调用回调函数
+    callback(this->image, clusters);
+}
+
+void mashiro::colorTiled(std::uint32_t number, MashiroColorCallback callback, int tileSize, std::uint32_t threads, int convertColor) noexcept {
+    // 每一块缩小后的最大宽度
+    constexpr int tileSampleWidth = 128;
+    
+    if (tileSize <= 0) tileSize = 1024;
+    int tilesX = (this->image.cols + tileSize - 1) / tileSize;
+    int tilesY = (this->image.rows + tileSize - 1) / tileSize;
     
-    // 获取调整后的图像上每种颜色及其出现的次数
-    vector<MashiroColorWithCount> pixels = mashiro::pixels(smallerImage);
+    // 每一块的带权重的局部调色板, 各自写入自己的位置, 不需要加锁
+    vector<vector<MashiroColorWithCount>> palettes(tilesX * tilesY);
+    mashiro::parallel(palettes.size(), threads, [&](size_t index, uint32_t worker) {
+        int x = static_cast<int>(index % tilesX) * tileSize;
+        int y = static_cast<int>(index / tilesX) * tileSize;
+        Mat tile = this->image(Rect(x, y, min(tileSize, this->image.cols - x), min(tileSize, this->image.rows - y)));
+        
+        // 缩小这一块并统计颜色, 太小的块直接使用原图
+        vector<MashiroColorWithCount> pixels = mashiro::pixels(tile, tileSampleWidth, INTER_AREA, convertColor);
+        
+        // 局部调色板的权重换算回原图上的像素个数
+        double sampled = 0;
+        for (const auto& colorWithCount : pixels) sampled += colorWithCount.second;
+        double scale = double(tile.rows * tile.cols) / max(sampled, 1.0);
+        vector<uint32_t> weights;
+        Cluster local = mashiro::kmeans(pixels, number, 1.0, &weights);
+        for (size_t i = 0; i < local.size(); i++) {
+            if (weights[i] == 0) continue;
+            palettes[index].emplace_back(local[i], static_cast<uint32_t>(weights[i] * scale + 0.5));
+        }
+    });
+    
+    // 合并所有局部调色板, 再做一次加权kmeans
+    vector<MashiroColorWithCount> merged;
+    for (const auto& palette : palettes) {
+        merged.insert(merged.end(), palette.cbegin(), palette.cend());
+    }
+    Cluster clusters = mashiro::kmeans(merged, number);
+    
+    // 调用回调函数
+    callback(this->image, clusters);
+}
+
+void mashiro::colorSampled(std::uint32_t number, MashiroColorCallback callback, double epsilon, int convertColor) noexcept {
+    // 抽样统计颜色
+    vector<MashiroColorWithCount> pixels = mashiro::sample(this->image, epsilon, 0.05, convertColor);
     
     // 使用kmeans聚类
-    Cluster clusters = this->kmeans(pixels, number);
+    Cluster clusters = mashiro::kmeans(pixels, number);
+    
+    // 调用回调函数
+    callback(this->image, clusters);
+}
+
+void mashiro::colorAuto(MashiroColorCallback callback, std::uint32_t kmax, int convertColor) noexcept {
+    // 把原始图像缩小到200像素宽, 同时获取每种颜色及其出现的次数
+    vector<MashiroColorWithCount> pixels = mashiro::pixels(this->image, 200, INTER_AREA, convertColor);
+    
+    // 自动决定聚类种数
+    Cluster clusters = mashiro::kmeansAuto(pixels, kmax);
+    
+    // 调用回调函数
+    callback(this->image, clusters);
+}
+
+void mashiro::colorPyramid(std::uint32_t number, MashiroColorCallback callback, int convertColor) noexcept {
+    // 由粗到细聚类, 最后一层与color()相同, 为200像素宽
+    Cluster clusters = mashiro::kmeansPyramid(this->image, number, 200, 1.0, nullptr, convertColor);
     
     // 调用回调函数
     callback(this->image, clusters);
 }
 
 void mashiro::resize(Mat &src, Mat &dest, int width, int height, int interpolation) noexcept {
+    MashiroPerfScope scope(MashiroPerfResize);
+    MashiroTraceScope span("resize");
+    
     // 如果宽或高有一个为非正数, 则返回原图像的拷贝给调整后的图像
     if (width * height <= 0) {
         dest = src.clone();
@@ -49,42 +122,173 @@ void mashiro::resize(Mat &src, Mat &dest, int width, int height, int interpolati
         width = w * ratio;
     } else {
         double ratio = width / double(w);
-        height = h * ratio;
+        height = max(1, int(h * ratio));
     }
     cv::resize(src, dest, ::Size(width, height), width/w, height/h, interpolation);
 }
 
 vector<MashiroColorWithCount> mashiro::pixels(Mat &image) noexcept {
-    // OpenCV里是按照BGR排列的
-    constexpr int R = 2;
-    constexpr int G = 1;
-    constexpr int B = 0;
-    
+    return mashiro::pixels(image, 0, INTER_AREA);
+}
+
+vector<MashiroColorWithCount> mashiro::pixels(Mat &image, int width, int interpolation, int convertColor) noexcept {
     // 统计某种颜色出现的次数
-    map<MashiroColor, std::uint32_t> colorCounter;
-    uint8_t r, g, b;
-    
-    // 直接使用C operator[]访问像素
-    Vec3b * pixel;
-    for(uint32_t i = 0; i < image.rows; ++i) {
-        pixel = image.ptr<Vec3b>(i);
-        for (uint32_t j = 0; j < image.cols; ++j) {
-            r = pixel[j][R];
-            g = pixel[j][G];
-            b = pixel[j][B];
-            colorCounter[MashiroColor(r, g, b)]++;
-        }
+    MashiroHistogram histogram;
+    mashiro::pixels(image, width, interpolation, convertColor, histogram);
+    
+    // 将统计的结果转为vector, 便于之后使用
+    vector<MashiroColorWithCount> pixels;
+    histogram.colors(pixels);
+    return pixels;
+}
+
+void mashiro::pixels(Mat &image, int width, int interpolation, int convertColor, MashiroHistogram& histogram) noexcept {
+    MashiroPerfScope scope(MashiroPerfPixels);
+    MashiroTraceScope span("pixels");
+    
+    // 逐行读取原图, 只读需要的行
+    MashiroDownsampler downsampler(histogram, image.cols, image.rows, width, interpolation, convertColor);
+    for (int i = 0; i < image.rows; i++) {
+        if (downsampler.wants(i)) downsampler.feed(i, image.ptr<uint8_t>(i));
     }
+}
+
+vector<MashiroColorWithCount> mashiro::sample(Mat &image, double epsilon, double delta, int convertColor, std::uint32_t * samples) noexcept {
+    // 8x8个区域, 每个区域先抽32个像素
+    constexpr int grid = 8;
+    constexpr int pilot = 32;
+    constexpr int bits = 3;
+    constexpr int bins = 1 << (bits * 3);
     
-    // 将colorCounter里统计的结果转为vector, 便于之后使用
     vector<MashiroColorWithCount> pixels;
-    for_each(colorCounter.cbegin(), colorCounter.cend(), [&pixels](const pair<MashiroColor, std::uint32_t>& pair){
-        pixels.emplace_back(MashiroColorWithCount(pair.first, pair.second));
-    });
+    if (image.empty()) return pixels;
+    
+    // 每个区域的范围与面积占比
+    int strata = grid * grid;
+    vector<Rect> regions;
+    vector<double> areas;
+    for (int gy = 0; gy < grid; gy++) {
+        for (int gx = 0; gx < grid; gx++) {
+            int x0 = image.cols * gx / grid, x1 = image.cols * (gx + 1) / grid;
+            int y0 = image.rows * gy / grid, y1 = image.rows * (gy + 1) / grid;
+            regions.emplace_back(x0, y0, x1 - x0, y1 - y0);
+            areas.emplace_back(double(x1 - x0) * (y1 - y0) / (double(image.cols) * image.rows));
+        }
+    }
+    
+    static atomic<uint64_t> streams(0);
+    Philox random(static_cast<uint64_t>(time(NULL)), streams++);
+    vector<uint8_t> drawn;
+    auto draw = [&](int h, uint32_t count) {
+        const Rect& region = regions[h];
+        if (region.width <= 0 || region.height <= 0) return;
+        for (uint32_t i = 0; i < count; i++) {
+            int x = region.x + random.uniform(region.width);
+            int y = region.y + random.uniform(region.height);
+            const uint8_t * pixel = image.ptr<uint8_t>(y) + x * 3;
+            drawn.insert(drawn.end(), pixel, pixel + 3);
+        }
+    };
+    
+    // 试抽样, 估计每个区域里每个粗量化颜色的比例
+    vector<uint32_t> pilotCounts(strata * bins, 0);
+    for (int h = 0; h < strata; h++) {
+        size_t begin = drawn.size();
+        draw(h, pilot);
+        for (size_t i = begin; i < drawn.size(); i += 3) {
+            int bin = (drawn[i + 2] >> (8 - bits)) << (bits * 2) | (drawn[i + 1] >> (8 - bits)) << bits | (drawn[i] >> (8 - bits));
+            pilotCounts[h * bins + bin]++;
+        }
+    }
+    
+    // 分层抽样下比例估计的方差为 sum(W_h * p_hb * (1 - p_hb)) / n
+    double variance = 0;
+    int occurring = 0;
+    for (int b = 0; b < bins; b++) {
+        double v = 0;
+        bool seen = false;
+        for (int h = 0; h < strata; h++) {
+            double p = pilotCounts[h * bins + b] / double(pilot);
+            v += areas[h] * p * (1 - p);
+            seen = seen || p > 0;
+        }
+        variance = max(variance, v);
+        occurring += seen;
+    }
+    
+    // 对出现过的颜色取Bonferroni校正, 用sqrt(2ln(2m/delta))作为正态分位数的上界
+    double z2 = 2.0 * log(2.0 * max(occurring, 1) / delta);
+    double total = double(image.cols) * image.rows;
+    double needed = min(total, max(double(pilot * strata), z2 * variance / (epsilon * epsilon)));
     
+    // 按面积补足每个区域的样本
+    for (int h = 0; h < strata; h++) {
+        double target = needed * areas[h];
+        if (target > pilot) draw(h, static_cast<uint32_t>(target - pilot + 0.5));
+    }
+    
+    // 颜色空间转换一次处理所有样本
+    Mat row(1, static_cast<int>(drawn.size() / 3), CV_8UC3, drawn.data());
+    Mat converted = row;
+    if (convertColor != -1) cvtColor(row, converted, convertColor);
+    
+    MashiroHistogram histogram;
+    const uint8_t * pixel = converted.ptr<uint8_t>(0);
+    for (int i = 0; i < converted.cols; i++) {
+        histogram.add(pixel[i * 3 + 2], pixel[i * 3 + 1], pixel[i * 3]);
+    }
+    histogram.colors(pixels);
+    if (samples) *samples = static_cast<uint32_t>(converted.cols);
     return pixels;
 }
 
+vector<MashiroColorWithCount> mashiro::coreset(const vector<MashiroColorWithCount>& pixels, std::uint32_t size, std::uint64_t seed) noexcept {
+    if (pixels.size() <= size || size == 0) return pixels;
+    
+    // 加权平均颜色, 以及到它的加权距离平方和
+    MashiroColor mean = mashiro::center(pixels);
+    double total = 0, spread = 0;
+    vector<double> distances(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) {
+        double d = MashiroColor::euclidean(pixels[i].first, mean);
+        distances[i] = d * d;
+        total += pixels[i].second;
+        spread += distances[i] * pixels[i].second;
+    }
+    
+    // 一半按权重, 一半按对方差的贡献抽样
+    vector<double> probability(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) {
+        probability[i] = 0.5 * pixels[i].second / total + (spread > 0 ? 0.5 * pixels[i].second * distances[i] / spread : 0.5 * pixels[i].second / total);
+    }
+    
+    // 排序后的均匀随机数与累积分布一起扫描一遍
+    Philox random(seed ? seed : static_cast<uint64_t>(time(NULL)));
+    vector<double> uniforms(size);
+    for (auto& u : uniforms) u = random.real();
+    sort(uniforms.begin(), uniforms.end());
+    
+    vector<double> weights(pixels.size(), 0);
+    double cumulative = 0;
+    size_t index = 0;
+    for (double u : uniforms) {
+        while (index + 1 < pixels.size() && cumulative + probability[index] <= u) {
+            cumulative += probability[index];
+            index++;
+        }
+        weights[index] += pixels[index].second / (size * probability[index]);
+    }
+    
+    // 同一种颜色被抽到多次时合并
+    vector<MashiroColorWithCount> sampled;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        if (weights[i] > 0) {
+            sampled.emplace_back(pixels[i].first, static_cast<uint32_t>(max(1.0, min(weights[i] + 0.5, double(UINT32_MAX)))));
+        }
+    }
+    return sampled;
+}
+
 MashiroColor mashiro::center(const vector<MashiroColorWithCount> &colors) noexcept {
     map<double, double> vals;
     double plen = 0;
@@ -106,47 +310,67 @@ MashiroColor mashiro::center(const vector<MashiroColorWithCount> &colors) noexce
     return MashiroColor(vals[0], vals[1], vals[2]);
 }
 
-Cluster mashiro::kmeans(const vector<MashiroColorWithCount>& pixels, std::uint32_t k, double min_diff) noexcept {
-    Cluster clusters;
-    
-    uint32_t randmax = static_cast<uint32_t>(pixels.size());
-    
-    // 使用标准MersenneTwister PRNG保证取的点的随机性
-    MersenneTwister mt(static_cast<uint32_t>(time(NULL)));
-    
-    // 取出k个点
-    for (uint32_t i = 0; i < k; i++) {
-        auto iter = pixels.cbegin();
-        for (uint32_t t = 0; t < mt.rand() % randmax; t++, iter++);
-        clusters.emplace_back(iter->first);
+uint32_t mashiro::lloyd(const vector<MashiroColorWithCount>& pixels, Cluster& clusters, double min_diff, vector<uint32_t>& labels, vector<array<double, 4>>& sums) noexcept {
+    MashiroPerfScope scope(MashiroPerfKMeans);
+    MashiroTraceScope span("kmeans");
+    constexpr uint32_t unassigned = UINT32_MAX;
+    uint32_t k = static_cast<uint32_t>(clusters.size());
+    if (k == 0) {
+        labels.clear();
+        sums.clear();
+        return 0;
     }
+    labels.assign(pixels.size(), unassigned);
     
+    // 每一类的 r * w, g * w, b * w, w
+    sums.assign(k, array<double, 4>{ {0, 0, 0, 0} });
+    
+    uint32_t rounds = 0;
     while (1) {
-        ClusteredPoint points;
+        rounds++;
         
-        // 与每一类的中心点比较距离, 找一个最邻近的类
-        for (auto iter = pixels.cbegin(); iter != pixels.cend(); iter++) {
-            MashiroColor color = iter->first;
-
+        // 与每一类的中心点比较距离, 找一个最邻近的类, 换了类的颜色从旧的类移到新的类
+        size_t changed = 0;
+        for (size_t index = 0; index < pixels.size(); index++) {
+            const MashiroColor& color = pixels[index].first;
+            
             double smallestDistance = DBL_MAX;
-            double distance;
-            uint32_t smallestIndex;
+            uint32_t smallestIndex = 0;
             for (uint32_t i = 0; i < k; i++) {
-                distance = color.euclidean(clusters[i]);
-                
+                double dr = color[0] - clusters[i][0];
+                double dg = color[1] - clusters[i][1];
+                double db = color[2] - clusters[i][2];
+                double distance = dr * dr + dg * dg + db * db;
                 if (distance < smallestDistance) {
                     smallestDistance = distance;
                     smallestIndex = i;
                 }
             }
-            points[smallestIndex].emplace_back(MashiroColorWithCount(color, iter->second));
+            
+            uint32_t previous = labels[index];
+            if (previous == smallestIndex) continue;
+            double weight = pixels[index].second;
+            if (previous != unassigned) {
+                for (int c = 0; c < 3; c++) sums[previous][c] -= color[c] * weight;
+                sums[previous][3] -= weight;
+            }
+            for (int c = 0; c < 3; c++) sums[smallestIndex][c] += color[c] * weight;
+            sums[smallestIndex][3] += weight;
+            labels[index] = smallestIndex;
+            changed++;
         }
         
-        // 重新计算每类的中心值
+        // 没有颜色换类时, 中心已经是各类的中心
+        if (changed == 0) {
+            break;
+        }
+        
+        // 重新计算每类的中心值, 没有分到颜色的类保持原来的中心
         double diff = 0;
         for (std::uint32_t i = 0; i < k; i++) {
+            if (sums[i][3] <= 0) continue;
             MashiroColor oldCenter = clusters[i];
-            MashiroColor newCenter = mashiro::center(points[i]);
+            MashiroColor newCenter(sums[i][0] / sums[i][3], sums[i][1] / sums[i][3], sums[i][2] / sums[i][3]);
             clusters[i] = newCenter;
             diff = max(diff, oldCenter.euclidean(newCenter));
         }
@@ -156,10 +380,224 @@ Cluster mashiro::kmeans(const vector<MashiroColorWithCount>& pixels, std::uint32
             break;
         }
     }
+    return rounds;
+}
+
+/**
+ *  @brief 每一类的加权误差平方和
+ */
+static vector<double> errors(const vector<MashiroColorWithCount>& pixels, const Cluster& clusters, const vector<uint32_t>& labels) noexcept {
+    vector<double> sse(clusters.size(), 0);
+    for (size_t index = 0; index < pixels.size(); index++) {
+        double distance = MashiroColor::euclidean(pixels[index].first, clusters[labels[index]]);
+        sse[labels[index]] += distance * distance * pixels[index].second;
+    }
+    return sse;
+}
+
+Cluster mashiro::kmeans(const vector<MashiroColorWithCount>& pixels, std::uint32_t k, double min_diff, std::vector<std::uint32_t> * weights) noexcept {
+    Cluster clusters;
+    if (k == 0) {
+        if (weights) weights->clear();
+        return clusters;
+    }
+    
+    // 颜色种数不超过k时, 每种颜色自成一类
+    if (pixels.size() <= k) {
+        if (weights) weights->clear();
+        for (const auto& colorWithCount : pixels) {
+            clusters.emplace_back(colorWithCount.first);
+            if (weights) weights->emplace_back(colorWithCount.second);
+        }
+        return clusters;
+    }
+    
+    uint32_t randmax = static_cast<uint32_t>(pixels.size());
+    
+    // 每次调用使用Philox的一个独立stream, 并行调用之间的随机序列互不相关
+    static atomic<uint64_t> streams(0);
+    Philox random(static_cast<uint64_t>(time(NULL)), streams++);
+    
+    // 取出k个点
+    for (uint32_t i = 0; i < k; i++) {
+        clusters.emplace_back(pixels[random.uniform(randmax)].first);
+    }
+    
+    return mashiro::kmeans(pixels, clusters, min_diff, weights);
+}
+
+Cluster mashiro::kmeans(const vector<MashiroColorWithCount>& pixels, const Cluster& seeds, double min_diff, std::vector<std::uint32_t> * weights) noexcept {
+    Cluster clusters(seeds);
+    vector<uint32_t> labels;
+    vector<array<double, 4>> sums;
+    mashiro::lloyd(pixels, clusters, min_diff, labels, sums);
+    
+    if (weights && clusters.empty()) {
+        weights->clear();
+    } else if (weights) {
+        weights->assign(clusters.size(), 0);
+        for (size_t index = 0; index < pixels.size(); index++) {
+            (*weights)[labels[index]] += pixels[index].second;
+        }
+    }
+    return clusters;
+}
+
+Cluster mashiro::kmeansPyramid(Mat& image, std::uint32_t k, int width, double min_diff, std::vector<std::uint32_t> * weights, int convertColor, std::uint32_t * rounds) noexcept {
+    // 最小的一层
+    constexpr int coarsest = 32;
+    
+    // 先按比例缩小到最后一层的宽度, 各层都从这张小图中取, 只读一次原图.
+    // resize()在宽或高为0时返回原图的拷贝, 所以这里自己算出高度
+    Mat small;
+    if (width > 0 && width < image.cols) {
+        int height = max(1, static_cast<int>(static_cast<int64_t>(image.rows) * width / image.cols));
+        mashiro::resize(image, small, width, height, INTER_AREA);
+    } else {
+        small = image;
+    }
+    
+    Cluster clusters;
+    vector<uint32_t> labels;
+    vector<array<double, 4>> sums;
+    vector<MashiroColorWithCount> pixels;
+    MashiroHistogram histogram;
+    for (int level = coarsest; level < small.cols; level <<= 1) {
+        histogram.clear();
+        mashiro::pixels(small, level, INTER_AREA, convertColor, histogram);
+        histogram.colors(pixels);
+        
+        // 颜色种数不足k时这一层给不出k个中心, 留给下一层
+        if (pixels.size() <= k) continue;
+        if (clusters.empty()) {
+            clusters = mashiro::kmeans(pixels, k, min_diff);
+        } else {
+            mashiro::lloyd(pixels, clusters, min_diff, labels, sums);
+        }
+    }
+    
+    // 最后一层为小图完整的直方图
+    histogram.clear();
+    mashiro::pixels(small, 0, INTER_AREA, convertColor, histogram);
+    histogram.colors(pixels);
+    if (clusters.empty() || pixels.size() <= k) {
+        if (rounds) *rounds = 0;
+        return mashiro::kmeans(pixels, k, min_diff, weights);
+    }
+    uint32_t finest = mashiro::lloyd(pixels, clusters, min_diff, labels, sums);
+    if (rounds) *rounds = finest;
     
+    if (weights) {
+        weights->assign(clusters.size(), 0);
+        for (size_t index = 0; index < pixels.size(); index++) {
+            (*weights)[labels[index]] += pixels[index].second;
+        }
+    }
     return clusters;
 }
 
+Cluster mashiro::kmeansAuto(const vector<MashiroColorWithCount>& pixels, std::uint32_t kmax, double minGain, vector<Cluster> * palettes) noexcept {
+    if (palettes) palettes->clear();
+    if (pixels.empty()) return Cluster();
+    
+    // 从一类开始
+    Cluster clusters(1, mashiro::center(pixels));
+    vector<uint32_t> labels(pixels.size(), 0);
+    vector<double> sse = errors(pixels, clusters, labels);
+    vector<array<double, 4>> sums;
+    double total = sse[0];
+    double previous = total;
+    Cluster chosen = clusters;
+    bool stopped = false;
+    if (palettes) palettes->emplace_back(clusters);
+    
+    while (clusters.size() < kmax) {
+        // 选误差最大且至少有两种颜色的类拆分
+        vector<uint32_t> members(clusters.size(), 0);
+        for (uint32_t label : labels) members[label]++;
+        int worst = -1;
+        for (size_t i = 0; i < clusters.size(); i++) {
+            if (members[i] >= 2 && (worst < 0 || sse[i] > sse[worst])) worst = static_cast<int>(i);
+        }
+        if (worst < 0) break;
+        
+        // 对这一类做2-means, 初始中心为离中心最远的颜色, 以及离它最远的颜色
+        vector<MashiroColorWithCount> subset;
+        for (size_t index = 0; index < pixels.size(); index++) {
+            if (labels[index] == uint32_t(worst)) subset.emplace_back(pixels[index]);
+        }
+        auto farthest = [&subset](const MashiroColor& from) {
+            size_t best = 0;
+            double distance = -1;
+            for (size_t i = 0; i < subset.size(); i++) {
+                double d = MashiroColor::euclidean(subset[i].first, from);
+                if (d > distance) {
+                    distance = d;
+                    best = i;
+                }
+            }
+            return subset[best].first;
+        };
+        MashiroColor first = farthest(clusters[worst]);
+        Cluster halves { first, farthest(first) };
+        vector<uint32_t> subsetLabels;
+        mashiro::lloyd(subset, halves, 1.0, subsetLabels, sums);
+        
+        // 拆分后以现有的中心为起点整体再迭代, 只需要很少几轮
+        clusters[worst] = halves[0];
+        clusters.emplace_back(halves[1]);
+        mashiro::lloyd(pixels, clusters, 1.0, labels, sums);
+        sse = errors(pixels, clusters, labels);
+        double current = 0;
+        for (double e : sse) current += e;
+        if (palettes) palettes->emplace_back(clusters);
+        
+        // 肘部判据: 新增一类减少的误差不足总误差的minGain时, 取上一个结果
+        if (!stopped) {
+            if (total <= 0 || (previous - current) / total < minGain) {
+                stopped = true;
+                if (!palettes) break;
+            } else {
+                chosen = clusters;
+            }
+        }
+        previous = current;
+    }
+    return chosen;
+}
+
+void mashiro::parallel(std::size_t count, std::uint32_t threads, const std::function<void(std::size_t index, std::uint32_t worker)>& body) noexcept {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    threads = static_cast<uint32_t>(min<size_t>(threads, count));
+    
+    // 每个线程从共享的计数器里领取下一个任务
+    atomic<size_t> next(0);
+    auto worker = [&](uint32_t id) {
+        for (size_t index = next++; index < count; index = next++) {
+            body(index, id);
+        }
+    };
+    
+    if (threads <= 1) {
+        worker(0);
+        return;
+    }
+    // 各线程的统计在线程退出前取出, 否则会随线程一起丢失
+    vector<MashiroPerfReport> reports(threads);
+    vector<thread> workers;
+    for (uint32_t id = 1; id < threads; id++) {
+        workers.emplace_back([&, id]() {
+            worker(id);
+            if (MashiroPerf::enabled()) reports[id] = MashiroPerf::collect();
+        });
+    }
+    worker(0);
+    for (auto& t : workers) t.join();
+    for (uint32_t id = 1; id < threads; id++) {
+        if (MashiroPerf::enabled()) MashiroPerf::merge(reports[id]);
+    }
+}
+
 MashiroColor::MashiroColor(double component1, double component2, double component3) noexcept {
     this->component[0] = component1;
     this->component[1] = component2;
@@ -9,16 +9,19 @@
 #ifndef MASHIRO_H
 #define MASHIRO_H
 
+#include <array>
 #include <assert.h>
 #include <cmath>
 #include <float.h>
 #include <functional>
 #include <map>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
 #include "MersenneTwister.h"
+#include "Philox.h"
 
 /**
  *  @brief Forward
@@ -26,6 +29,7 @@
 namespace cv { class Mat; };
 class mashiro;
 class MashiroColor;
+class MashiroHistogram;
 
 /**
  RGB色彩空间
@@ -70,6 +74,50 @@ public:
      */
     void color(std::uint32_t number, MashiroColorCallback callback, int convertColor = -1) noexcept;
     
+    /**
+     *  @brief 识别主要颜色, 自动决定颜色的种数
+     *
+     *  @param callback     聚类完成后的回调
+     *  @param kmax         最多几种颜色
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     */
+    void colorAuto(MashiroColorCallback callback, std::uint32_t kmax = 8, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 分块并行识别主要颜色
+     *
+     *  @discussion 适用于上亿像素的大图. 每一块单独缩小并聚类, 得到带权重的局部调色板,
+     *              最后对所有局部调色板做一次加权kmeans. 临时内存只与块的大小有关
+     *
+     *  @param number       需要几种主要颜色
+     *  @param callback     聚类完成后的回调
+     *  @param tileSize     每一块的边长(像素)
+     *  @param threads      线程数, 0表示使用全部核心
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     */
+    void colorTiled(std::uint32_t number, MashiroColorCallback callback, int tileSize = 1024, std::uint32_t threads = 0, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 对像素分层随机抽样后识别主要颜色
+     *
+     *  @discussion 抽样数由误差要求决定, 与图片大小无关, 见mashiro::sample
+     *
+     *  @param number       需要几种主要颜色
+     *  @param callback     聚类完成后的回调
+     *  @param epsilon      颜色比例允许的误差
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     */
+    void colorSampled(std::uint32_t number, MashiroColorCallback callback, double epsilon = 0.02, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 由粗到细地识别主要颜色, 结果与color()相近, 但迭代更少
+     *
+     *  @param number       需要几种主要颜色
+     *  @param callback     聚类完成后的回调
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     */
+    void colorPyramid(std::uint32_t number, MashiroColorCallback callback, int convertColor = -1) noexcept;
+    
     /**
      *  @brief 快速访问std::tuple里的元素
      *
@@ -102,6 +150,57 @@ public:
      */
     static std::vector<MashiroColorWithCount> pixels(cv::Mat &image) noexcept;
     
+    /**
+     *  @brief 缩小图片的同时统计颜色, 不生成缩小后的图片
+     *
+     *  @param image         源图片
+     *  @param width         缩小后的宽度, 高度按比例计算, 不大于0或不小于原宽度时不缩小
+     *  @param interpolation cv::INTER_AREA对每块求平均, cv::INTER_NEAREST只取每块中心的像素
+     *  @param convertColor  颜色空间转换, -1表示不转换
+     *
+     *  @return 缩小后的图上所有的颜色及其出现的次数
+     */
+    static std::vector<MashiroColorWithCount> pixels(cv::Mat &image, int width, int interpolation, int convertColor = -1) noexcept;
+    
+    /**
+     *  @brief 同上, 结果累加到给定的直方图中
+     */
+    static void pixels(cv::Mat &image, int width, int interpolation, int convertColor, MashiroHistogram& histogram) noexcept;
+    
+    
+    /**
+     *  @brief 分层随机抽样统计颜色
+     *
+     *  @discussion 把图片划分为8x8个区域, 先在每个区域抽取少量像素, 估计各区域内
+     *              粗量化颜色(每分量3位)比例的方差, 再按区域面积补足样本, 使每个粗量化颜色
+     *              的比例误差以1-delta的概率不超过epsilon. 纯色的图只需要几千个像素,
+     *              颜色复杂的图会自动抽取更多
+     *
+     *  @param image        源图片
+     *  @param epsilon      颜色比例允许的误差
+     *  @param delta        超出误差的概率
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     *  @param samples      可选, 输出实际抽取的像素个数
+     *
+     *  @return 抽到的颜色及其出现的次数
+     */
+    static std::vector<MashiroColorWithCount> sample(cv::Mat &image, double epsilon = 0.02, double delta = 0.05, int convertColor = -1, std::uint32_t * samples = nullptr) noexcept;
+    
+    /**
+     *  @brief 为带权重的颜色构造coreset
+     *
+     *  @discussion Lightweight coreset: 以 q(x) = w(x) / 2W + w(x) d(x, μ)² / 2Σw d² 的概率
+     *              有放回地抽取size次, 每次抽到的颜色的权重为 w(x) / (size * q(x)). 对任意k个中心,
+     *              coreset上的kmeans代价与原数据的代价之差以高概率有界, 误差随size增大按1/sqrt(size)减小.
+     *              结果可以直接交给任何聚类函数
+     *
+     *  @param pixels 图上出现的颜色及其次数
+     *  @param size   抽样次数, 也是结果中颜色种数的上限
+     *  @param seed   随机数种子
+     *
+     *  @return 不超过size种带权重的颜色, 总权重约等于原来的总像素数
+     */
+    static std::vector<MashiroColorWithCount> coreset(const std::vector<MashiroColorWithCount>& pixels, std::uint32_t size = 4096, std::uint64_t seed = 0) noexcept;
     
     /**
      *  @brief 给定一组带出现次数的颜色求其中心
@@ -111,11 +210,6 @@ public:
      *  @return 该组颜色的中心值
      */
     static MashiroColor center(const std::vector<MashiroColorWithCount>& colors) noexcept;
-private:
-    /**
-     *  @brief 需要处理的图像
-     */
-    cv::Mat& image;
     
     /**
      *  @brief kmeans聚类
@@ -123,10 +217,93 @@ private:
      *  @param pixels       图上出现的颜色及其次数
      *  @param k            聚类种数
      *  @param min_diff     偏差
+     *  @param weights      可选, 输出每一类包含的像素个数
      *
      *  @return 聚类后的k个颜色
      */
-    Cluster kmeans(const std::vector<MashiroColorWithCount>& pixels, std::uint32_t k, double min_diff = 1.0) noexcept;
+    static Cluster kmeans(const std::vector<MashiroColorWithCount>& pixels, std::uint32_t k, double min_diff = 1.0, std::vector<std::uint32_t> * weights = nullptr) noexcept;
+    
+    /**
+     *  @brief 从给定的中心开始kmeans聚类
+     *
+     *  @param pixels       图上出现的颜色及其次数
+     *  @param seeds        初始的中心
+     *  @param min_diff     偏差
+     *  @param weights      可选, 输出每一类包含的像素个数
+     *
+     *  @return 聚类后的颜色, 与seeds一一对应
+     */
+    static Cluster kmeans(const std::vector<MashiroColorWithCount>& pixels, const Cluster& seeds, double min_diff = 1.0, std::vector<std::uint32_t> * weights = nullptr) noexcept;
+    
+    /**
+     *  @brief 从给定的中心开始迭代, 直到没有颜色换类, 或中心的移动小于min_diff
+     *
+     *  @discussion 每一类维护加权的分量和, 只有换了类的颜色才更新分量和, 中心直接由分量和算出,
+     *              不必每轮重新累加所有颜色. 每一轮仍要计算每种颜色到所有中心的距离, 代价为O(n·k).
+     *              分量和是浮点数, 合并过的调色板等带小数的颜色会有舍入误差.
+     *              clusters为空时直接返回0, labels与sums被清空.
+     *              labels与sums由调用者提供, 反复调用时容量足够就不会重新分配
+     *
+     *  @param pixels   图上出现的颜色及其次数
+     *  @param clusters 初始的中心, 输出迭代后的中心
+     *  @param min_diff 偏差
+     *  @param labels   输出每种颜色所属的类
+     *  @param sums     输出每一类的 r * w, g * w, b * w, w
+     *
+     *  @return 迭代的轮数
+     */
+    static std::uint32_t lloyd(const std::vector<MashiroColorWithCount>& pixels, Cluster& clusters, double min_diff, std::vector<std::uint32_t>& labels, std::vector<std::array<double, 4>>& sums) noexcept;
+    
+    /**
+     *  @brief 多分辨率kmeans
+     *
+     *  @discussion 先把图按比例缩小到width宽, 再从32像素宽开始, 每层宽度加倍, 在小图的直方图上迭代到收敛,
+     *              以得到的中心作为下一层的初始中心. 最后一层是width宽的完整直方图, 迭代到收敛.
+     *              在1600x1200的噪声图上, 最后一层平均需要2到8轮, 从随机中心开始则需要4到16轮;
+     *              前几层的直方图小, 但缩小原图与统计各层仍有固定的开销, k较大时才更快
+     *
+     *  @param image        BGR图像
+     *  @param k            聚类种数
+     *  @param width        最后一层的宽度
+     *  @param min_diff     偏差
+     *  @param weights      可选, 输出每一类包含的像素个数
+     *  @param convertColor 颜色空间转换, -1表示不转换
+     *  @param rounds       可选, 输出最后一层迭代的轮数
+     *
+     *  @return 聚类后的颜色
+     */
+    static Cluster kmeansPyramid(cv::Mat& image, std::uint32_t k, int width = 200, double min_diff = 1.0, std::vector<std::uint32_t> * weights = nullptr, int convertColor = -1, std::uint32_t * rounds = nullptr) noexcept;
+    
+    /**
+     *  @brief 自动决定聚类种数的kmeans
+     *
+     *  @discussion 二分kmeans: 从一类开始, 每次把误差最大的一类一分为二, 再以现有的中心为起点
+     *              整体迭代. 当新增一类减少的误差不足总误差的minGain时, 选择上一个结果
+     *
+     *  @param pixels   图上出现的颜色及其次数
+     *  @param kmax     最多几类
+     *  @param minGain  新增一类至少需要减少的误差比例
+     *  @param palettes 可选, 输出1到kmax类的所有结果, 第i个有i + 1种颜色
+     *
+     *  @return 选中的聚类结果
+     */
+    static Cluster kmeansAuto(const std::vector<MashiroColorWithCount>& pixels, std::uint32_t kmax = 8, double minGain = 0.02, std::vector<Cluster> * palettes = nullptr) noexcept;
+    
+    /**
+     *  @brief 用多个线程处理[0, count)
+     *
+     *  @discussion 打开MashiroPerf时, 其他线程剩下的统计在结束后累加到调用线程
+     *
+     *  @param count   任务个数
+     *  @param threads 线程数, 0表示使用全部核心
+     *  @param body    处理第index个任务, worker为线程编号
+     */
+    static void parallel(std::size_t count, std::uint32_t threads, const std::function<void(std::size_t index, std::uint32_t worker)>& body) noexcept;
+private:
+    /**
+     *  @brief 需要处理的图像
+     */
+    cv::Mat& image;
 };
 
 /**
@@ -146,26 +323,14 @@ public:
         return component[index];
     }
     
-    int operator < (const MashiroColor& color2) const {
-        const MashiroColor color1 = * this;
-        if (color1[0] < color2[0]) {
-            return -1;
-        } else if (color1[0] == color2[0]) {
-            if (color1[1] < color2[1]) {
-                return -1;
-            } else if (color1[1] == color2[1]) {
-                if (color1[2] < color2[2]) {
-                    return -1;
-                } else if (color1[2] == color2[2]) {
-                    return 0;
-                } else {
-                    return 1;
-                }
-            } else {
-                return 1;
-            }
+    bool operator < (const MashiroColor& color2) const {
+        const MashiroColor& color1 = * this;
+        if (color1[0] != color2[0]) {
+            return color1[0] < color2[0];
+        } else if (color1[1] != color2[1]) {
+            return color1[1] < color2[1];
         } else {
-            return 1;
+            return color1[2] < color2[2];
         }
     }
     
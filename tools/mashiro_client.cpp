@@ -0,0 +1,91 @@
+//
+//  mashiro_client.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include <getopt.h>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../MashiroDaemon.h"
+
+using namespace cv;
+using namespace std;
+
+const char * socketFile = "/tmp/mashiro.sock";
+uint32_t color = 3;
+bool sharedMemory = false;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"socket", required_argument, 0, 's'},
+    {"color", required_argument, 0, 'c'},
+    {"shm", no_argument, 0, 'm'},
+    {0, 0, 0, 0}
+};
+
+void print_usage() {
+    printf("Usage:\n");
+    printf("\tmashiro_client -s [socket] -c [number of color to cluster] [image file...]\n");
+    printf("\t-m Decode the image here and send the pixels through shared memory\n");
+    printf("\t-h Print this help\n");
+}
+
+int main(int argc, const char * argv[]) {
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, (char * const *)argv, "hs:c:m", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 's':
+                socketFile = optarg;
+                break;
+            case 'c':
+                color = abs(atoi(optarg));
+                break;
+            case 'm':
+                sharedMemory = true;
+                break;
+            default:
+                print_usage();
+                return 0;
+        }
+    }
+    if (optind >= argc) {
+        print_usage();
+        return 0;
+    }
+    
+    MashiroClient client(socketFile);
+    if (!client.connected()) {
+        perror(socketFile);
+        return 1;
+    }
+    
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        Cluster colors;
+        bool ok;
+        if (sharedMemory) {
+            Mat image = imread(argv[i]);
+            uint64_t stride;
+            int memory = image.empty() ? -1 : MashiroClient::share(image, stride);
+            ok = memory >= 0 && client.color(memory, image.cols, image.rows, stride, color, colors);
+            if (memory >= 0) close(memory);
+        } else {
+            ok = client.color(argv[i], color, colors);
+        }
+        if (!ok) {
+            cerr<<argv[i]<<": failed"<<endl;
+            status = 1;
+            continue;
+        }
+        if (argc - optind > 1) cout<<argv[i]<<endl;
+        for_each(colors.cbegin(), colors.cend(), [](const MashiroColor& color){
+            cout<<"("<<color[0]<<", "<<color[1]<<", "<<color[2]<<")"<<endl;
+        });
+    }
+    return status;
+}
@@ -0,0 +1,230 @@
+//
+//  mashiro_collage.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include "../mashiro.h"
+#include "../MashiroContext.h"
+
+using namespace cv;
+using namespace std;
+
+int classes = 12;
+int size = 300;
+int linePadding = 15;
+int columns = 0;
+uint32_t threads = 0;
+const char * outputFile = "collage.jpg";
+
+/**
+ *  @brief 整张图的最大边长, WebP最大为16383, JPEG与PNG也都能写出, 此时整张图约占800MB
+ */
+constexpr int maxSide = 16383;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"classes", required_argument, 0, 'k'},
+    {"size", required_argument, 0, 's'},
+    {"padding", required_argument, 0, 'p'},
+    {"columns", required_argument, 0, 'w'},
+    {"threads", required_argument, 0, 'j'},
+    {"output", required_argument, 0, 'o'},
+    {0, 0, 0, 0}
+};
+
+/**
+ *  @brief 一张封面
+ */
+struct Cover {
+    string path;
+    double hue;
+    int bucket;
+    Mat thumbnail;
+};
+
+void print_usage() {
+    printf("Usage:\n");
+    printf("\tmashiro_collage [image directory] -k [hue buckets] -s [cover size] -o [output image]\n");
+    printf("\t-p [padding] Space around each cover, defaults to 15\n");
+    printf("\t-w [columns] Covers per row in each bucket, 0 chooses a roughly square collage\n");
+    printf("\t             Covers and padding shrink so that neither side exceeds %d px\n", maxSide);
+    printf("\t-j [threads] Number of threads, defaults to all cores\n");
+    printf("\t-h Print this help\n");
+}
+
+/**
+ *  @brief 递归列出目录下的所有图片
+ */
+static void list(const string& directory, vector<string>& paths) {
+    static const char * extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".webp", ".tif", ".tiff" };
+    DIR * dir = opendir(directory.c_str());
+    if (!dir) return;
+    while (struct dirent * entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        string path = directory + "/" + entry->d_name;
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0) continue;
+        if (S_ISDIR(status.st_mode)) {
+            list(path, paths);
+        } else if (S_ISREG(status.st_mode)) {
+            const char * dot = strrchr(entry->d_name, '.');
+            if (dot && any_of(begin(extensions), end(extensions), [dot](const char * extension) { return strcasecmp(dot, extension) == 0; })) {
+                paths.emplace_back(path);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+int main(int argc, const char * argv[]) {
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, (char * const *)argv, "hk:s:p:w:j:o:", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'k':
+                classes = max(atoi(optarg), 2);
+                break;
+            case 's':
+                size = max(atoi(optarg), 1);
+                break;
+            case 'p':
+                linePadding = max(atoi(optarg), 0);
+                break;
+            case 'w':
+                columns = max(atoi(optarg), 0);
+                break;
+            case 'j':
+                threads = abs(atoi(optarg));
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            default:
+                print_usage();
+                return 0;
+        }
+    }
+    if (argc - optind < 1) {
+        print_usage();
+        return 0;
+    }
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    
+    vector<string> paths;
+    list(argv[optind], paths);
+    sort(paths.begin(), paths.end());
+    
+    // 每张图只解码一次, 同时留下缩略图. 缩略图的总面积不超过整张图的上限,
+    // 最后排版时封面只会比这更小
+    int thumbnailSize = min(size, max(1, static_cast<int>(maxSide / sqrt(double(max<size_t>(paths.size(), 1))))));
+    
+    // 第一遍: 并行计算每张封面的主要颜色, 按色相分类. 每个线程一个计算上下文
+    vector<Cover> covers(paths.size());
+    vector<unique_ptr<MashiroContext>> contexts;
+    for (uint32_t i = 0; i < threads; i++) contexts.emplace_back(new MashiroContext());
+    mashiro::parallel(paths.size(), threads, [&](size_t index, uint32_t worker) {
+        Cover& cover = covers[index];
+        cover.path = paths[index];
+        cover.bucket = -1;
+        Mat image = imread(cover.path);
+        if (image.empty()) return;
+        
+        // 结果为RGB. 三个分量相差不到1的接近灰色的封面没有可靠的色相, 归入第一类
+        const Cluster& colors = contexts[worker]->color(image, 1);
+        const MashiroColor& rgb = colors.back();
+        double spread = max({ rgb[0], rgb[1], rgb[2] }) - min({ rgb[0], rgb[1], rgb[2] });
+        if (spread < 1.0) {
+            cover.hue = 0;
+        } else {
+            cover.hue = MashiroColor::RGB2HSV(rgb)[0];
+        }
+        cover.bucket = min(classes - 1, static_cast<int>(floor(cover.hue / (360.0 / classes))));
+        cv::resize(image, cover.thumbnail, cv::Size(thumbnailSize, thumbnailSize), 0, 0, INTER_AREA);
+    });
+    
+    // 每一类按色相排列, 确定每张封面的位置
+    vector<vector<const Cover *>> buckets(classes);
+    for (const auto& cover : covers) {
+        if (cover.bucket < 0) {
+            cerr<<cover.path<<": cannot read image"<<endl;
+            continue;
+        }
+        buckets[cover.bucket].emplace_back(&cover);
+        cout<<cover.path<<" hue: "<<cover.hue<<" index: "<<cover.bucket<<'\n';
+    }
+    size_t longest = 0;
+    for (auto& bucket : buckets) {
+        sort(bucket.begin(), bucket.end(), [](const Cover * a, const Cover * b) { return a->hue < b->hue || (a->hue == b->hue && a->path < b->path); });
+        longest = max(longest, bucket.size());
+    }
+    if (longest == 0) {
+        cerr<<"no images in "<<argv[optind]<<endl;
+        return 1;
+    }
+    
+    // 每类占columns列, 未指定时让整张图接近正方形
+    if (columns == 0) columns = max(1, static_cast<int>(round(sqrt(double(longest) / classes))));
+    int lines = static_cast<int>((longest + columns - 1) / columns);
+    
+    // 超过最大边长时按比例缩小封面与间距, 色块的高度与封面相同, 所以高度按lines + 1格计算
+    int requested = size;
+    size = min(size, thumbnailSize);
+    int cell = size + (linePadding << 1);
+    int64_t fitted = min<int64_t>({ cell, maxSide / (int64_t(columns) * classes), maxSide / (int64_t(lines) + 1) });
+    if (fitted < 1) {
+        cerr<<int64_t(columns) * classes<<" columns by "<<lines<<" lines cannot fit in "<<maxSide<<" px, try another -w"<<endl;
+        return 1;
+    }
+    if (fitted < cell) {
+        linePadding = static_cast<int>(linePadding * fitted / cell);
+        size = max(1, static_cast<int>(fitted) - (linePadding << 1));
+        cell = size + (linePadding << 1);
+    }
+    if (size < requested) cerr<<"covers shrunk to "<<size<<" px to fit in "<<maxSide<<" px"<<endl;
+    int width = cell * columns * classes;
+    int height = size + linePadding + lines * cell;
+    Mat statistics(height, width, CV_8UC3, Scalar(255, 255, 255));
+    
+    struct Placement {
+        const Cover * cover;
+        cv::Rect roi;
+    };
+    vector<Placement> placements;
+    for (int i = 0; i < classes; i++) {
+        int left = cell * columns * i;
+        MashiroColor rgb(MashiroColor::HSV2RGB(MashiroColor((360.0 / classes) * i, 1, 1)));
+        rectangle(statistics, cv::Point(left + linePadding, linePadding), cv::Point(left + cell * columns - linePadding, linePadding + size), Scalar(rgb[2] * 255, rgb[1] * 255, rgb[0] * 255), CV_FILLED);
+        for (size_t numbered = 0; numbered < buckets[i].size(); numbered++) {
+            int x = left + static_cast<int>(numbered % columns) * cell + linePadding;
+            int y = linePadding + static_cast<int>(numbered / columns + 1) * cell;
+            placements.push_back({ buckets[i][numbered], cv::Rect(x, y, size, size) });
+        }
+        cerr<<"bucket "<<i<<": "<<buckets[i].size()<<" covers"<<endl;
+    }
+    
+    // 第二遍: 各线程把缩略图缩小到整张图中互不重叠的位置
+    mashiro::parallel(placements.size(), threads, [&](size_t index, uint32_t worker) {
+        const Placement& placement = placements[index];
+        Mat ROI = statistics(placement.roi);
+        cv::resize(placement.cover->thumbnail, ROI, ROI.size(), 0, 0, INTER_AREA);
+    });
+    
+    if (!imwrite(outputFile, statistics)) {
+        cerr<<"cannot write "<<outputFile<<" ("<<width<<"x"<<height<<")"<<endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+//
+//  mashiro_dump.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include <algorithm>
+#include <getopt.h>
+#include <iostream>
+#include <stdlib.h>
+#include "../MashiroJson.h"
+#include "../MashiroResultFile.h"
+
+using namespace std;
+
+long first = 0;
+long limit = -1;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"first", required_argument, 0, 'f'},
+    {"number", required_argument, 0, 'n'},
+    {0, 0, 0, 0}
+};
+
+void print_usage() {
+    printf("Usage:\n");
+    printf("\tmashiro_dump [result file] -f [first record] -n [number of records]\n");
+    printf("\tPrint the records of a binary result file as JSON lines\n");
+    printf("\t-h Print this help\n");
+}
+
+int main(int argc, const char * argv[]) {
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, (char * const *)argv, "hf:n:", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'f':
+                first = labs(atol(optarg));
+                break;
+            case 'n':
+                limit = labs(atol(optarg));
+                break;
+            default:
+                print_usage();
+                return 0;
+        }
+    }
+    if (argc - optind < 1) {
+        print_usage();
+        return 0;
+    }
+    
+    MashiroResultFile results(argv[optind]);
+    if (!results.valid()) {
+        cerr<<"invalid result file "<<argv[optind]<<endl;
+        return 1;
+    }
+    
+    size_t end = results.size();
+    if (limit >= 0) end = min<size_t>(end, first + limit);
+    for (size_t i = first; i < end; i++) {
+        cout<<"{\"id\":"<<results.id(i)<<",\"path\":";
+        cout<<MashiroJson::quote(results.name(i));
+        cout<<",\"colors\":[";
+        uint32_t count = min(results.count(i), results.capacity());
+        const float * centers = results.centers(i);
+        for (uint32_t k = 0; k < count; k++) {
+            cout<<(k ? ",[" : "[")<<centers[k * 3]<<','<<centers[k * 3 + 1]<<','<<centers[k * 3 + 2]<<']';
+        }
+        cout<<"],\"weights\":[";
+        const float * weights = results.weights(i);
+        for (uint32_t k = 0; k < count; k++) {
+            cout<<(k ? "," : "")<<weights[k];
+        }
+        cout<<"]}\n";
+    }
+    return 0;
+}
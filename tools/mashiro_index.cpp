@@ -0,0 +1,118 @@
+//
+//  mashiro_index.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include <chrono>
+#include <getopt.h>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include "../MashiroPaletteIndex.h"
+
+using namespace cv;
+using namespace std;
+
+uint32_t lists = 0;
+uint32_t results = 10;
+uint32_t probes = 8;
+uint32_t color = 5;
+const char * imageFile = NULL;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"lists", required_argument, 0, 'l'},
+    {"results", required_argument, 0, 'n'},
+    {"probes", required_argument, 0, 'p'},
+    {"image", required_argument, 0, 'i'},
+    {"color", required_argument, 0, 'c'},
+    {0, 0, 0, 0}
+};
+
+void print_usage() {
+    printf("Usage:\n");
+    printf("\tmashiro_index build [batch output or .mshr result file] [index file] -l [number of lists]\n");
+    printf("\tmashiro_index query [index file] -n [results] -p [probes] -i [image file] -c [number of color]\n");
+    printf("\tmashiro_index query [index file] -n [results] -p [probes] r,g,b,weight ...\n");
+    printf("\t-h Print this help\n");
+}
+
+int main(int argc, const char * argv[]) {
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, (char * const *)argv, "hl:n:p:i:c:", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'l':
+                lists = abs(atoi(optarg));
+                break;
+            case 'n':
+                results = abs(atoi(optarg));
+                break;
+            case 'p':
+                probes = abs(atoi(optarg));
+                break;
+            case 'i':
+                imageFile = optarg;
+                break;
+            case 'c':
+                color = abs(atoi(optarg));
+                break;
+            default:
+                print_usage();
+                return 0;
+        }
+    }
+    if (argc - optind < 2) {
+        print_usage();
+        return 0;
+    }
+    
+    string command = argv[optind];
+    if (command == "build" && argc - optind >= 3) {
+        if (!MashiroPaletteIndex::build(argv[optind + 1], argv[optind + 2], lists)) {
+            cerr<<"failed to build "<<argv[optind + 2]<<endl;
+            return 1;
+        }
+        return 0;
+    } else if (command == "query") {
+        MashiroPaletteIndex index(argv[optind + 1]);
+        if (!index.valid()) {
+            cerr<<"invalid index "<<argv[optind + 1]<<endl;
+            return 1;
+        }
+        
+        // 查询的调色板来自一张图, 或者命令行上的r,g,b,weight
+        Cluster colors;
+        vector<uint32_t> weights;
+        if (imageFile) {
+            Mat image = imread(imageFile);
+            if (image.empty()) {
+                cerr<<"cannot read "<<imageFile<<endl;
+                return 1;
+            }
+            colors = mashiro::kmeans(mashiro::pixels(image, 200, INTER_AREA), color, 1.0, &weights);
+        } else {
+            for (int i = optind + 2; i < argc; i++) {
+                double r, g, b;
+                unsigned weight = 1;
+                if (sscanf(argv[i], "%lf,%lf,%lf,%u", &r, &g, &b, &weight) < 3) continue;
+                colors.emplace_back(r, g, b);
+                weights.emplace_back(weight);
+            }
+        }
+        
+        auto start = chrono::steady_clock::now();
+        vector<MashiroPaletteMatch> matches = index.search(colors, weights, results, probes);
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        for (const auto& match : matches) {
+            const char * name = index.name(match.id);
+            cout<<match.distance<<'\t'<<(name ? name : "")<<endl;
+        }
+        cerr<<matches.size()<<" of "<<index.size()<<" palettes in "<<elapsed<<" ms"<<endl;
+        return 0;
+    }
+    print_usage();
+    return 0;
+}
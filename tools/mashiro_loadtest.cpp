@@ -0,0 +1,356 @@
+//
+//  mashiro_loadtest.cpp
+//  Mashiro
+//
+//  Created by BlueCocoa on 16/2/2.
+//  Copyright © 2016 BlueCocoa. All rights reserved.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../mashiro.h"
+#include "../MashiroBatch.h"
+#include "../MashiroContext.h"
+#include "../MashiroDaemon.h"
+#include "../MashiroPerf.h"
+#include "../MashiroTrace.h"
+#include "../Philox.h"
+
+using namespace cv;
+using namespace std;
+
+const char * socketFile = "/tmp/mashiro.sock";
+const char * target = "daemon";
+uint32_t color = 3;
+uint32_t requests = 1000;
+uint32_t concurrency = 4;
+double rate = 0;
+bool preload = false;
+int syntheticWidth = 0;
+int syntheticHeight = 0;
+int syntheticCount = 16;
+const char * baselineOutput = NULL;
+const char * baselineInput = NULL;
+double threshold = 10;
+bool perf = false;
+const char * traceFile = NULL;
+
+static struct option long_options[] = {
+    {"help", no_argument, 0, 'h'},
+    {"socket", required_argument, 0, 's'},
+    {"target", required_argument, 0, 't'},
+    {"color", required_argument, 0, 'c'},
+    {"requests", required_argument, 0, 'n'},
+    {"concurrency", required_argument, 0, 'j'},
+    {"rate", required_argument, 0, 'r'},
+    {"shm", no_argument, 0, 'm'},
+    {"synthetic", required_argument, 0, 'y'},
+    {"save", required_argument, 0, 'o'},
+    {"baseline", required_argument, 0, 'B'},
+    {"threshold", required_argument, 0, 'x'},
+    {"perf", no_argument, 0, 'P'},
+    {"trace", required_argument, 0, 'T'},
+    {0, 0, 0, 0}
+};
+
+void print_usage() {
+    printf("Usage:\n");
+    printf("\tmashiro_loadtest -t [target] -n [requests] -j [concurrency] -c [number of color] [image file...]\n");
+    printf("\t-t [target] daemon (default), color (mashiro::color), context (MashiroContext) or batch (MashiroBatch)\n");
+    printf("\t-s [socket] Socket of the daemon target, defaults to /tmp/mashiro.sock\n");
+    printf("\t-r [rate] Start requests at this rate per second instead of back to back; latency counts from the scheduled start\n");
+    printf("\t-m Decode every image once beforehand; the daemon target then sends pixels through shared memory\n");
+    printf("\t-y [width]x[height][x count] Use generated images instead of files, 16 by default\n");
+    printf("\t-o [file] Save the results as a baseline\n");
+    printf("\t-B [file] Compare with a baseline and fail if throughput, p50 or p99 is worse by more than the threshold\n");
+    printf("\t-x [percent] Regression threshold, defaults to 10\n");
+    printf("\t-P Print hardware counters of each stage, for the in-process targets\n");
+    printf("\t-T [file] Write a Chrome trace of the in-process targets\n");
+    printf("\t-h Print this help\n");
+    printf("\tThe daemon should run with at least as many threads as -j\n");
+}
+
+/**
+ *  @brief 生成一张由几种颜色的色块组成并带有噪声的图, 同样的序号得到同样的图
+ */
+static Mat synthesize(int width, int height, uint64_t seed) {
+    Philox random(0x6d617368, seed);
+    uint8_t palette[6][3];
+    for (auto& entry : palette) {
+        for (auto& channel : entry) channel = static_cast<uint8_t>(random.uniform(256));
+    }
+    Mat image(height, width, CV_8UC3);
+    for (int i = 0; i < height; i++) {
+        uint8_t * row = image.ptr<uint8_t>(i);
+        for (int j = 0; j < width; j++) {
+            const uint8_t * base = palette[((i >> 5) * 7 + (j >> 5) * 3) % 6];
+            for (int k = 0; k < 3; k++) row[j * 3 + k] = static_cast<uint8_t>(min(255, base[k] + static_cast<int>(random.uniform(16))));
+        }
+    }
+    return image;
+}
+
+/**
+ *  @brief 读取基准文件, 每行一个"名字 数值"
+ */
+static map<string, string> load(const char * path) {
+    map<string, string> values;
+    ifstream input(path);
+    string key, value;
+    while (input>>key>>value) values[key] = value;
+    return values;
+}
+
+int main(int argc, const char * argv[]) {
+    int c, option_index = 0;
+    while ((c = getopt_long(argc, (char * const *)argv, "hs:t:c:n:j:r:my:o:B:x:PT:", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 's':
+                socketFile = optarg;
+                break;
+            case 't':
+                target = optarg;
+                break;
+            case 'c':
+                color = abs(atoi(optarg));
+                break;
+            case 'n':
+                requests = abs(atoi(optarg));
+                break;
+            case 'j':
+                concurrency = max(1, abs(atoi(optarg)));
+                break;
+            case 'r':
+                rate = fabs(atof(optarg));
+                break;
+            case 'm':
+                preload = true;
+                break;
+            case 'y':
+                if (sscanf(optarg, "%dx%dx%d", &syntheticWidth, &syntheticHeight, &syntheticCount) < 2 || syntheticWidth <= 0 || syntheticHeight <= 0 || syntheticCount <= 0) {
+                    print_usage();
+                    return 0;
+                }
+                break;
+            case 'o':
+                baselineOutput = optarg;
+                break;
+            case 'B':
+                baselineInput = optarg;
+                break;
+            case 'x':
+                threshold = fabs(atof(optarg));
+                break;
+            case 'P':
+                perf = true;
+                break;
+            case 'T':
+                traceFile = optarg;
+                break;
+            default:
+                print_usage();
+                return 0;
+        }
+    }
+    bool daemon = strcmp(target, "daemon") == 0;
+    bool batch = strcmp(target, "batch") == 0;
+    bool context = strcmp(target, "context") == 0;
+    if ((!daemon && !batch && !context && strcmp(target, "color") != 0) || (optind >= argc && syntheticWidth == 0)) {
+        print_usage();
+        return 0;
+    }
+    if (perf) MashiroPerf::enable(true);
+    if (traceFile) MashiroTrace::enable(true);
+    
+    // 生成的图片都预先放在内存中, 批量处理只接受路径, 所以写入临时目录
+    vector<string> images(argv + optind, argv + argc);
+    vector<Mat> decoded;
+    char directory[] = "/tmp/mashiro_loadtest.XXXXXX";
+    bool temporary = false;
+    if (syntheticWidth > 0) {
+        images.clear();
+        preload = !batch;
+        if (batch && !(temporary = mkdtemp(directory) != NULL)) {
+            perror("mashiro_loadtest");
+            return 1;
+        }
+        for (int i = 0; i < syntheticCount; i++) {
+            Mat image = synthesize(syntheticWidth, syntheticHeight, i);
+            if (batch) {
+                images.emplace_back(string(directory) + "/" + to_string(i) + ".png");
+                imwrite(images.back(), image);
+            } else {
+                images.emplace_back("synthetic " + to_string(i));
+                decoded.emplace_back(image);
+            }
+        }
+    } else if (preload) {
+        for (const auto& path : images) decoded.emplace_back(imread(path));
+    }
+    
+    // 共享内存模式下, 每张图只解码一次, 之后反复发送同一块内存
+    vector<int> memories;
+    vector<uint64_t> strides;
+    if (daemon && preload) {
+        for (auto& image : decoded) {
+            uint64_t stride = 0;
+            memories.emplace_back(image.empty() ? -1 : MashiroClient::share(image, stride));
+            strides.emplace_back(stride);
+        }
+    }
+    
+    atomic<uint32_t> next(0), failures(0);
+    vector<vector<double>> latencies(concurrency);
+    MashiroPerfReport report;
+    mutex reportLock;
+    auto begin = chrono::steady_clock::now();
+    if (batch) {
+        // 批量处理不能控制每张图的开始时间, 以同一线程上相邻两次完成的间隔作为延迟
+        if (rate > 0) cerr<<"-r is ignored by the batch target"<<endl;
+        vector<string> paths(requests);
+        for (uint32_t i = 0; i < requests; i++) paths[i] = images[i % images.size()];
+        vector<chrono::steady_clock::time_point> last(concurrency, begin);
+        vector<thread::id> owners(concurrency);
+        MashiroBatch(color, concurrency).run(paths, [&](size_t index, const string& path, const Cluster& colors, const vector<uint32_t>& weights) {
+            auto now = chrono::steady_clock::now();
+            if (colors.empty()) failures++;
+            MashiroPerfReport stages;
+            if (perf) stages = MashiroPerf::collect();
+            
+            // 回调并发执行, 各线程按出现的顺序占用一个位置
+            lock_guard<mutex> lock(reportLock);
+            size_t slot = find(owners.begin(), owners.end(), this_thread::get_id()) - owners.begin();
+            if (slot == owners.size()) slot = find(owners.begin(), owners.end(), thread::id()) - owners.begin();
+            owners[slot] = this_thread::get_id();
+            latencies[slot].emplace_back(chrono::duration<double, milli>(now - last[slot]).count());
+            last[slot] = now;
+            report += stages;
+        });
+    } else {
+        vector<thread> workers;
+        for (uint32_t id = 0; id < concurrency; id++) {
+            workers.emplace_back([&, id]() {
+                unique_ptr<MashiroClient> client;
+                unique_ptr<MashiroContext> worker;
+                if (daemon) client.reset(new MashiroClient(socketFile));
+                if (context) worker.reset(new MashiroContext());
+                for (uint32_t i = next++; i < requests; i = next++) {
+                    size_t which = i % images.size();
+                    auto start = chrono::steady_clock::now();
+                    
+                    // 按固定速率开始时, 延迟从计划的开始时间算起, 排队的时间也计算在内
+                    if (rate > 0) {
+                        start = begin + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(i / rate));
+                        this_thread::sleep_until(start);
+                    }
+                    bool ok;
+                    if (daemon) {
+                        Cluster colors;
+                        if (preload) {
+                            ok = memories[which] >= 0 && client->color(memories[which], decoded[which].cols, decoded[which].rows, strides[which], color, colors);
+                        } else {
+                            ok = client->color(images[which], color, colors);
+                        }
+                    } else {
+                        Mat image;
+                        if (preload) {
+                            image = decoded[which];
+                        } else {
+                            MashiroPerfScope scope(MashiroPerfDecode);
+                            MashiroTraceScope span("decode");
+                            image = imread(images[which]);
+                        }
+                        ok = !image.empty();
+                        if (ok && context) {
+                            ok = !worker->color(image, color).empty();
+                        } else if (ok) {
+                            mashiro shiro(image);
+                            shiro.color(color, [&ok](Mat&, const Cluster& colors) { ok = !colors.empty(); });
+                        }
+                    }
+                    latencies[id].emplace_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+                    if (!ok) failures++;
+                }
+                if (perf) {
+                    MashiroPerfReport stages = MashiroPerf::collect();
+                    lock_guard<mutex> lock(reportLock);
+                    report += stages;
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    for (int memory : memories) if (memory >= 0) close(memory);
+    if (temporary) {
+        for (const auto& path : images) unlink(path.c_str());
+        rmdir(directory);
+    }
+    
+    vector<double> all;
+    for (const auto& latency : latencies) all.insert(all.end(), latency.cbegin(), latency.cend());
+    sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p * all.size()))]; };
+    
+    map<string, double> results = {
+        { "throughput", (all.size() - failures) / elapsed },
+        { "p50", percentile(0.50) },
+        { "p99", percentile(0.99) },
+        { "p999", percentile(0.999) },
+    };
+    printf("target: %s, concurrency: %u, requests: %zu, failures: %u, elapsed: %.3f s\n", target, concurrency, all.size(), failures.load(), elapsed);
+    printf("throughput: %.1f images/s\n", results["throughput"]);
+    printf("latency: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n", results["p50"], results["p99"], results["p999"], all.empty() ? 0.0 : all.back());
+    if (perf) {
+        if (daemon) {
+            printf("stages: not available for the daemon target\n");
+        } else {
+            printf("stages: %s\n", MashiroPerf::json(report).c_str());
+        }
+    }
+    if (traceFile && !MashiroTrace::write(traceFile)) cerr<<traceFile<<": cannot write trace"<<endl;
+    
+    if (baselineOutput) {
+        ofstream output(baselineOutput, ios::trunc);
+        output<<"target "<<target<<"\nconcurrency "<<concurrency<<"\nrate "<<rate<<'\n';
+        for (const auto& result : results) output<<result.first<<' '<<result.second<<'\n';
+        if (!output.flush()) cerr<<baselineOutput<<": cannot save baseline"<<endl;
+    }
+    
+    // 吞吐量越高越好, 延迟越低越好. p999的样本太少, 只作参考
+    bool regressed = false;
+    if (baselineInput) {
+        map<string, string> baseline = load(baselineInput);
+        if (baseline.empty()) {
+            cerr<<baselineInput<<": cannot read baseline"<<endl;
+            return 1;
+        }
+        if (baseline["target"] != target || atof(baseline["concurrency"].c_str()) != concurrency || atof(baseline["rate"].c_str()) != rate) {
+            cerr<<"warning: the baseline was measured with target "<<baseline["target"]<<", concurrency "<<baseline["concurrency"]<<", rate "<<baseline["rate"]<<endl;
+        }
+        for (const auto& result : results) {
+            if (baseline.find(result.first) == baseline.end()) continue;
+            double previous = atof(baseline[result.first].c_str());
+            double change = previous > 0 ? (result.second / previous - 1) * 100 : 0;
+            bool worse = result.first == "throughput" ? change < -threshold : change > threshold;
+            bool checked = result.first != "p999";
+            printf("%s: %.3f -> %.3f (%+.1f%%)%s\n", result.first.c_str(), previous, result.second, change, worse && checked ? " REGRESSION" : "");
+            if (worse && checked) regressed = true;
+        }
+    }
+    return failures || regressed ? 1 : 0;
+}